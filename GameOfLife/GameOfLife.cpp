@@ -1,10 +1,36 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <time.h>
+#include <vector>
 #define SDL_MAIN_HANDLED
 #include "SDL.h"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
@@ -25,14 +51,34 @@ struct cellLoc
 	}
 };
 
+// Packed into one word. States go up to 255 for Generations rules; only state 1 counts as a neighbor. neighbors has bit
+// (dy + 1) * 3 + dx + 1 set for each live neighbor at offset (dx, dy), so with the cell's own state as bit 4 it indexes a 3x3 rule table.
 struct cellData
 {
-	int currState, nextState, numNeighbors;
+	int currState : 9, nextState : 9, neighbors : 10;
+};
+
+// One cell's share of a bulk insert: its own birth, or one neighbor's bit in its neighborhood
+struct cellDelta
+{
+	cellLoc loc;
+	int neighbors, born;
+};
+
+// A cell's change of state, queued by trackChange() for bookkeeping that is brought up to date only when it is next needed
+struct stateChange
+{
+	cellLoc loc;
+	int from, to;
 };
 
 struct ruleSet
 {
-	set<int> birthList, surviveList;
+	set<int> birthList = {}, surviveList = {};
+	int states = 2;		// More than 2 for Generations rules, where cells that die pass through states 2 to states - 1 before turning off
+	map<int, string> birthLetters = {}, surviveLetters = {};	// Non-totalistic rules: the Hensel letters of the neighborhoods included for a count (all if absent)
+	int range = 1;		// Larger than Life rules count the (2 * range + 1)^2 square; their counts never include the cell itself
+	bool middle = false;	// Larger than Life rules written with the cell counting itself (M1)
 };
 
 struct color
@@ -40,13 +86,406 @@ struct color
 	unsigned int r, g, b;
 };
 
-const color colors[] = { {0, 0, 0}, {255, 255, 255} };
+// Read-only view of a whole file. It is memory-mapped, so large patterns are paged in as they are parsed rather than read into memory.
+struct mappedFile
+{
+	const char* data = NULL;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE, mapping = NULL;
+#else
+	int fd = -1;
+#endif
+
+	bool open(const string& path)
+	{
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		LARGE_INTEGER length;
+		if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &length))
+		{
+			return false;
+		}
+		size = (size_t)length.QuadPart;
+		if (size > 0)
+		{
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			data = mapping ? (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+		}
+#else
+		fd = ::open(path.c_str(), O_RDONLY);
+		struct stat info;
+		if (fd < 0 || fstat(fd, &info) != 0)
+		{
+			return false;
+		}
+		size = (size_t)info.st_size;
+		if (size > 0)
+		{
+			void* view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			data = (view == MAP_FAILED) ? NULL : (const char*)view;
+			if (data)
+			{
+				madvise(view, size, MADV_SEQUENTIAL);
+			}
+		}
+#endif
+		return size == 0 || data != NULL;
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (data)
+		{
+			UnmapViewOfFile(data);
+		}
+		if (mapping)
+		{
+			CloseHandle(mapping);
+		}
+		if (file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(file);
+		}
+		file = INVALID_HANDLE_VALUE;
+		mapping = NULL;
+#else
+		if (data)
+		{
+			munmap((void*)data, size);
+		}
+		if (fd >= 0)
+		{
+			::close(fd);
+		}
+		fd = -1;
+#endif
+		data = NULL;
+		size = 0;
+	}
+
+	~mappedFile()
+	{
+		close();
+	}
+};
+
+// Binary checkpoint: this header, then tileCount checkpointTile records, then the rule as text if the bitmasks can't hold it.
+// Everything is in native byte order and naturally aligned, so a mapped file is read in place with no parsing.
+struct checkpointHeader
+{
+	char magic[8];				// CHECKPOINT_MAGIC
+	Uint32 birth, survive;		// Rule, as bitmasks of neighbor counts
+	Sint64 frame;
+	Sint32 centerX, centerY;
+	Uint32 cellSize, flags;		// flags: CHECKPOINT_INVERTED, CHECKPOINT_RULE_TEXT
+	Uint32 topology;			// 0 for the unbounded plane, else the TOPOLOGY_* of a boundsW x boundsH box
+	Sint32 boundsW, boundsH;
+	Uint32 padding;
+	Uint64 tileCount;
+};
+
+// 8x8 block of cells with its top left corner at (8x, 8y); bit (row * 8 + column) is set for live cells
+struct checkpointTile
+{
+	Sint32 x, y;
+	Uint64 bits;
+};
+
+// 64x64 block of live cells. Checkpoint snapshots share tiles with the universe, and a tile is copied the first time it changes
+// while a snapshot is being written.
+struct cowTile
+{
+	int epoch;			// Snapshot epoch this copy belongs to; older tiles may still be shared with the snapshot
+	Uint64 rows[64];	// Bit x of rows[y] is the cell at (64 * tileX + x, 64 * tileY + y)
+};
+
+// One generation of rewind history: the cells that toggled on the way to it, and every HISTORY_KEYFRAME generations the whole state
+struct historyFrame
+{
+	int frame;
+	bool keyframe;
+	bool inverted;					// Value of inverted at this generation
+	vector<checkpointTile> state;	// Live cells at this generation (keyframes only)
+	vector<Uint8> changes;			// Toggled cells in map order, as zigzag varint deltas from the previous cell
+};
+
+// One --bench measurement: a corpus pattern stepped BENCH_TRIALS times on one engine
+struct benchResult
+{
+	string pattern, engine;
+	int repeats = 0;				// Runs per trial (0 = not warmed up yet)
+	vector<double> rates;			// Generations per second of each trial
+	map<string, double> phases;		// Mean time per trial spent in each phase (ms)
+	Sint64 population;
+	Uint64 hash;					// Final state, which every trial must agree on
+};
+
+// One entry of a session recording: an input event handled at a generation, the end of a frame's events (where the main loop
+// applies the edits they queued), the adaptive controller moving to another engine, or the end of the session
+struct sessionRecord
+{
+	Uint8 kind;			// SESSION_*
+	Sint32 frame;
+	SDL_Event event;	// SESSION_EVENT
+	string file;		// SESSION_EVENT: the path of a dropped file
+	int engine;			// SESSION_ENGINE: index into ENGINES
+};
+
+// One --scale measurement: a soup of population cells stepped on threads threads
+struct scalePoint
+{
+	string sweep, engine;			// sweep: size, strong or weak
+	int threads;
+	Sint64 population;
+	double rate;					// Generations per second
+	size_t bytes;					// engine::memory() after stepping
+	double efficiency;				// Throughput against the size sweep's peak, or against one thread's for the thread sweeps
+};
+
+// Period and displacement of a detected cycle (period 0 = none)
+struct cycleInfo
+{
+	int period, dx, dy;
+};
+
+// Generation remembered by the cycle detector, with its centroid to work out displacement
+struct recentState
+{
+	int frame;
+	cellLoc centroid;
+};
+
+// Recent changes in a 16x16 tile, used to put tiles that repeat with period 1 or 2 to sleep
+struct tileActivity
+{
+	Uint64 changes[3];				// cellKey() hash of the cells toggled this generation [0] (being built), last generation [1] and the one before [2]
+	Uint64 rim[3][8];				// The same, restricted to each side (W, E, N, S) and corner (NW, NE, SW, SE) of the tile
+	vector<cellLoc> toggled[2];		// Cells toggled this generation [0] and last generation [1], which a sleeping tile repeats
+	int wake;						// Generations to stay awake after an edit nearby
+	bool awake;						// Evaluated next generation rather than repeating its last toggles
+};
+
+// Node of a Macrocell quadtree. Level 3 nodes are 8x8 leaves stored as a bitmap; others reference earlier nodes by number (0 = empty).
+struct mcNode
+{
+	int level;
+	Uint64 bits;
+	int child[4];
+};
+
+// Writes a Macrocell file node by node while building the quadtree, sharing identical leaves and subtrees
+struct mcWriter
+{
+	ofstream out;
+	map<Uint64, int> leaves;
+	map<array<int, 5>, int> nodes;
+	int count = 0;
+
+	int build(int level, int x0, int y0, vector<cellLoc>::iterator begin, vector<cellLoc>::iterator end)
+	{
+		// Number of the node covering the 2^level square at (x0, y0), whose live cells are [begin, end); 0 if empty
+		if (begin == end)
+		{
+			return 0;
+		}
+		if (level == 3)
+		{
+			Uint64 bits = 0;
+			for (vector<cellLoc>::iterator cell = begin; cell != end; cell++)
+			{
+				bits |= 1ull << ((cell->y - y0) * 8 + (cell->x - x0));
+			}
+			map<Uint64, int>::iterator leaf = leaves.find(bits);
+			if (leaf != leaves.end())
+			{
+				return leaf->second;
+			}
+
+			// Rows of . and * ended by $, leaving off trailing dead cells and rows
+			string line;
+			for (int y = 0; y < 8 && (bits >> (y * 8)) != 0; y++)
+			{
+				int rowBits = (int)((bits >> (y * 8)) & 0xFF);
+				for (int x = 0; rowBits >> x; x++)
+				{
+					line += ((rowBits >> x) & 1) ? '*' : '.';
+				}
+				line += '$';
+			}
+			out << line << '\n';
+			return leaves[bits] = ++count;
+		}
+
+		// Split into quadrants in nw, ne, sw, se order
+		int half = 1 << (level - 1);
+		vector<cellLoc>::iterator south = partition(begin, end, [&](const cellLoc& c) { return c.y < y0 + half; });
+		vector<cellLoc>::iterator northEast = partition(begin, south, [&](const cellLoc& c) { return c.x < x0 + half; });
+		vector<cellLoc>::iterator southEast = partition(south, end, [&](const cellLoc& c) { return c.x < x0 + half; });
+		array<int, 5> node = { level,
+			build(level - 1, x0, y0, begin, northEast),
+			build(level - 1, x0 + half, y0, northEast, south),
+			build(level - 1, x0, y0 + half, south, southEast),
+			build(level - 1, x0 + half, y0 + half, southEast, end) };
+
+		map<array<int, 5>, int>::iterator shared = nodes.find(node);
+		if (shared != nodes.end())
+		{
+			return shared->second;
+		}
+		out << node[0] << ' ' << node[1] << ' ' << node[2] << ' ' << node[3] << ' ' << node[4] << '\n';
+		return nodes[node] = ++count;
+	}
+};
+
+// xoshiro256** generator: much faster than rand() and reproducible from a single 64-bit seed
+struct xoshiro256
+{
+	Uint64 s[4];
+
+	void seed(Uint64 value)
+	{
+		// Expand the seed with splitmix64 so that similar seeds give unrelated streams
+		for (int i = 0; i < 4; i++)
+		{
+			Uint64 z = (value += 0x9E3779B97F4A7C15ull);
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			s[i] = z ^ (z >> 31);
+		}
+	}
+
+	Uint64 next()
+	{
+		Uint64 result = rotl(s[1] * 5, 7) * 9;
+		Uint64 t = s[1] << 17;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl(s[3], 45);
+		return result;
+	}
+
+	static Uint64 rotl(Uint64 x, int k)
+	{
+		return (x << k) | (x >> (64 - k));
+	}
+};
+
+// Simulation engine. The universe runs on one engine at a time, chosen by name; each holds the cells in its own way and steps
+// them with its own algorithm, so engines can be swapped and compared on the same pattern.
+struct engine
+{
+	virtual ~engine() {}
+	virtual string name() = 0;
+	virtual bool supports(const ruleSet& r) = 0;	// Whether the engine can run a rule
+	virtual void clear() = 0;
+	virtual void step(int generations) = 0;
+	virtual int getCell(cellLoc cell) = 0;
+	virtual void setCell(cellLoc cell, int state) = 0;
+	virtual void load(vector<cellLoc>& live) = 0;	// Bulk insert: turn on every cell in live
+	virtual void viewport(cellLoc low, cellLoc high, vector<pair<cellLoc, int>>& out) = 0;	// Cells not in state 0 from low up to (not including) high
+	virtual Sint64 population() = 0;
+	virtual Uint64 hash() = 0;		// XOR of cellKey() times 2 * state - 1 over cells not in state 0
+	virtual Sint64 changes() = 0;	// Cells that changed state in the last generation
+	virtual bool bounds(cellLoc& low, cellLoc& high) = 0;	// Bounding box of the cells not in state 0; false if there are none
+	virtual void setThreads(int threads) = 0;	// Threads step() may split a generation across
+	virtual size_t memory() = 0;	// Bytes held for the cells, roughly
+};
+
+vector<color> colors = { {0, 0, 0}, {255, 255, 255} };		// By state; compileRule() adds the dying states of Generations rules
 
 // Constants
 const unsigned int WIDTH = 1900;
 const unsigned int HEIGHT = 1000;
 unsigned int CELL_SIZE = 5;
 unsigned int FRAME_DELAY = 0;
+double SOUP_DENSITY = 0.5;		// Fraction of cells turned on by createRandom()
+int BRUSH_SIZE = 1;				// Width of the square painted by mouse strokes, in cells
+Uint64 RANDOM_SEED = 0;			// 0 = seed from the clock; set with --seed to reproduce a run
+const char CHECKPOINT_MAGIC[8] = { 'G', 'O', 'L', 'C', 'K', 'P', 'T', '2' };	// The last character is the format version
+const Uint32 CHECKPOINT_INVERTED = 1;				// Header flag: the tiles hold the complement of the universe
+const Uint32 CHECKPOINT_RULE_TEXT = 2;				// Header flag: the rule follows the tiles in B/S notation, as the bitmasks can't hold Hensel letters
+const string CHECKPOINT_FILE = "checkpoint.gol";	// Written by F5 and every CHECKPOINT_INTERVAL generations, restored by F9
+int CHECKPOINT_INTERVAL = 0;						// Generations between background checkpoints (0 = off); set with --checkpoint
+const char SESSION_MAGIC[8] = { 'G', 'O', 'L', 'S', 'E', 'S', 'S', '1' };
+const Uint8 SESSION_EVENT = 0, SESSION_APPLY = 1, SESSION_ENGINE = 2, SESSION_END = 3;	// Kinds of sessionRecord
+int VIDEO_EVERY = 1;					// Generations between the frames written by --video
+int VIDEO_QUEUE = 16;					// Frames --video may fall behind before the simulation waits for it; set with --video-queue
+const int VIDEO_FPS = 30;				// Frame rate in the header of a Y4M video
+int POSTER_SCALE = 1;					// Pixels per cell side in posters; set with --poster
+const int POSTER_BAND = 64;				// Rows of pixels in each band of a poster, at least one row of cells
+const int POSTER_BORDER = 8;			// Cells of background around the pattern in a poster of the unbounded plane
+const int HISTORY_KEYFRAME = 100;		// Generations between full states in the rewind history
+size_t HISTORY_MEMORY = 256;			// Memory cap for the rewind history (MB; 0 = off); set with --history
+const int CYCLE_WINDOW = 1024;			// Generations remembered by the cycle detector, which bounds the longest period it finds
+const int FAST_FORWARD = 1000000;		// Generations skipped by F once a cycle is detected
+const Uint64 HASH_PRIME = (1ull << 61) - 1;	// Modulus of the shape hash
+const Uint64 HASH_BASE[2] = { 0x1D2B3C4D5E6F7A8Bull % HASH_PRIME, 0x0A1B2C3D4E5F6071ull % HASH_PRIME };	// Per axis bases of the shape hash
+const int ACTIVITY_SHIFT = 4;			// Sleeping tiles are 2^ACTIVITY_SHIFT cells square
+const size_t LOAD_BATCH = 1 << 18;	// Live cells collected by the pattern loaders before each load() call, which bounds their memory
+const unsigned int IDLE_WAIT = 1000;		// Longest time to block waiting for events (ms); also the stats refresh interval while paused
+const int MAX_RANGE = 10;				// Largest Larger than Life range
+const Sint64 MAX_DENSE = 65536;			// Largest side of the dense engine's box on the unbounded plane
+const Sint64 DENSE_BAND_CELLS = 1 << 20;	// Fewest cells of the dense engine's box per thread stepping it
+int STEP_THREADS = 0;					// Threads for engines that split a generation (0 = one per CPU); set with --threads
+const int ADAPT_INTERVAL = 64;			// Generations between the adaptive controller's samples
+const double ADAPT_THRESHOLD = 1.5;		// Predicted speedup needed before the adaptive controller switches engine
+const double ADAPT_MAP_COST = 5e-6;		// Starting estimate of the map engine's seconds per changed cell
+const double ADAPT_DENSE_COST = 4e-10;	// Starting estimate of the dense engine's seconds per cell of its box
+const int VERIFY_GENERATIONS = 500;		// Generations each --verify run is stepped unless given
+const int VERIFY_SOUP = 48;				// Size of the random soups run by --verify
+const int VERIFY_POPULATION = 2000;		// Population that ends a --verify run early, so explosive rules stay quick
+const int VERIFY_DISTANCE = 200000;		// Offset between the two soups --verify runs Larger than Life rules on
+const string VERIFY_CHECKPOINT = "verify.gol";	// Checkpoint --verify writes and restores, then deletes
+const int BENCH_GENERATIONS = 500;		// Generations each --bench trial is stepped
+const int BENCH_SOUP = 128;				// Size of the random soup in the --bench corpus
+const int BENCH_DYING_STATES = 3;		// States of the Generations rule --bench also steps the soup under, next to a two state rule
+const Uint64 BENCH_TRIAL_TIME = 50;	// Shortest --bench trial (ms); quicker runs are repeated within the trial
+int BENCH_TRIALS = 5;					// Trials of each --bench measurement, for its confidence interval; set with --trials
+const double BENCH_NOISE = 0.1;		// Change in speed --compare ignores even when the confidence intervals don't overlap
+const Sint64 SCALE_MIN_CELLS = 1000;	// Smallest soup of the --scale size sweep, which grows tenfold from here
+const Sint64 SCALE_MAX_CELLS = 1000000000;	// Largest soup of the --scale size sweep unless given
+const Sint64 SCALE_STRONG = 1000000;	// Live cells of the --scale strong scaling sweep, split between more and more threads
+const Sint64 SCALE_WEAK = 100000;		// Live cells per thread of the --scale weak scaling sweep
+const Uint64 SCALE_TIME = 200;			// Time each --scale point is stepped for (ms)
+const double SCALE_MEMORY = 2048;		// Largest memory a --scale point may be predicted to need (MB)
+const double SCALE_SECONDS = 60;		// Longest a --scale point may be predicted to take (s)
+const Sint64 LATENCY_MAX_CELLS = 1000000;	// Largest soup --latency runs the operations against unless given; soups grow tenfold from 1000
+const int LATENCY_SAMPLES = 100;		// Times --latency runs each operation on each soup
+const double SCALE_FLAT = 1.1;			// Gain in throughput from one --scale point to the next below which it has flattened
+const int TOPOLOGY_TORUS = 1;			// Bounded universe whose edges wrap around to the opposite edge
+const int TOPOLOGY_KLEIN = 2;			// Bounded universe wrapping like a torus, but reflected left to right across the top and bottom edges
+const int TOPOLOGY_PLANE = 3;			// Bounded universe with dead cells beyond its edges
+const color EDGE_COLOR = { 48, 48, 48 };	// Drawn outside a bounded universe
+
+// Hensel notation: the letters for each neighbor count up to 4, and a representative neighborhood (in cellData::neighbors bits) for each.
+// The other neighborhoods with a letter are its rotations and reflections, and counts 5 to 7 use the letters of their complements.
+const string HENSEL_LETTERS[5] = { "", "ce", "ceaikn", "ceaiknjqry", "ceaiknjqrytwz" };
+const int HENSEL_NEIGHBORHOODS[5][13] =
+{
+	{ 0 },
+	{ 1, 2 },
+	{ 5, 10, 3, 40, 33, 68 },
+	{ 69, 42, 11, 7, 98, 13, 14, 70, 41, 97 },
+	{ 325, 170, 15, 45, 99, 71, 106, 102, 43, 101, 105, 78, 108 }
+};
+
+// The same letters drawn out for the reference engine, as count and letter then the 3x3 neighborhood row by row (o for a live
+// neighbor). Kept apart from the tables above so that --verify catches a mistake in either.
+const map<string, string> HENSEL_PICTURES =
+{
+	{"1c", "o........"}, {"1e", ".o......."},
+	{"2c", "o.o......"}, {"2e", ".o.o....."}, {"2a", "oo......."}, {"2i", "...o.o..."}, {"2k", ".o....o.."}, {"2n", "o.......o"},
+	{"3c", "o.o...o.."}, {"3e", ".o.o.o..."}, {"3a", "oo.o....."}, {"3i", "ooo......"}, {"3k", ".o...oo.."},
+	{"3n", "o.oo....."}, {"3j", ".ooo....."}, {"3q", ".oo...o.."}, {"3r", "o..o.o..."}, {"3y", "o....oo.."},
+	{"4c", "o.o...o.o"}, {"4e", ".o.o.o.o."}, {"4a", "oooo....."}, {"4i", "o.oo.o..."}, {"4k", "oo...oo.."},
+	{"4n", "ooo...o.."}, {"4j", ".o.o.oo.."}, {"4q", ".oo..oo.."}, {"4r", "oo.o.o..."}, {"4t", "o..o.oo.."},
+	{"4w", ".ooo..o.."}, {"4y", "o.o..oo.."}, {"4z", "..oo.oo.."}
+};
 
 // Initial display range
 int numRows = HEIGHT / (CELL_SIZE + 1);
@@ -59,6 +498,7 @@ map<string, ruleSet> RULES =
 	{"Conway's Game of Life", {{3}, {2, 3}}},
 	{"3-4 Life", {{3, 4}, {3, 4}}},
 	{"Amoeba", {{3, 5, 7}, {1, 3, 5, 8}}},
+	{"Brian's Brain", {{2}, {}, 3}},
 	{"Coagulations" , {{3, 7, 8}, {2, 3, 5, 6, 7, 8}}},
 	{"Coral" , {{3}, {4, 5, 6, 7, 8}}},
 	{"Corrosion of Conformity" , {{3}, {1, 2, 4}}},
@@ -67,336 +507,5396 @@ map<string, ruleSet> RULES =
 	{"Gnarl" , {{1}, {1}}},
 	{"High Life" , {{3, 6}, {2, 3}}},
 	{"Inverse Life" , {{0, 1, 2, 3, 4, 7, 8}, {3, 4, 6, 7, 8}}},
+	{"Just Friends" , {{2}, {1, 2}, 2, {{2, "ceikn"}}}},
 	{"Long Life" , {{3, 4, 5}, {5}}},
 	{"Maze" , {{3}, {1, 2, 3, 4, 5}}},
 	{"Mazectric" , {{3}, {1, 2, 3, 4}}},
 	{"Pseudo Life" , {{3, 5, 7}, {2, 3, 8}}},
 	{"Replicator" , {{1, 3, 5, 7}, {1, 3, 5, 7}}},
+	{"Salad" , {{2, 3, 4}, {2, 3}, 2, {{2, "i"}, {4, "c"}}, {{2, "ceakn"}}}},
 	{"Seeds" , {{2}, {}}},
 	{"Serviettes" , {{2, 3, 4}, {}}},
 	{"Stains" , {{3, 6, 7, 8}, {2, 3, 5, 6, 7, 8}}},
+	{"Star Wars" , {{2}, {3, 4, 5}, 4}},
+	{"Tlife" , {{3}, {2, 3, 4}, 2, {}, {{2, "ceakn"}, {4, "q"}}}},
 	{"Walled Cities" , {{3, 6, 7, 8}, {2, 3, 5, 6, 7, 8}}}
 };
 
-// Select ruleset to use
-const string ruleName = "Conway's Game of Life";
-const ruleSet rules = RULES[ruleName];
+// Patterns run through every engine by --verify and --bench, as rows of live (o) and dead (.) cells
+map<string, vector<string>> VERIFY_PATTERNS =
+{
+	{"Acorn", {".o.....", "...o...", "oo..ooo"}},
+	{"Diehard", {"......o.", "oo......", ".o...ooo"}},
+	{"Glider", {".o.", "..o", "ooo"}},
+	{"Gosper glider gun", {
+		"........................o...........",
+		"......................o.o...........",
+		"............oo......oo............oo",
+		"...........o...o....oo............oo",
+		"oo........o.....o...oo..............",
+		"oo........o...o.oo....o.o...........",
+		"..........o.....o.......o...........",
+		"...........o...o....................",
+		"............oo......................"}},
+	{"Lightweight spaceship", {".o..o", "o....", "o...o", "oooo."}},
+	{"Pentadecathlon", {"..o....o..", "oo.oooo.oo", "..o....o.."}},
+	{"R-pentomino", {".oo", "oo.", ".o."}}
+};
+
+// Larger than Life rules run by --verify besides RULES, which has none
+const vector<string> VERIFY_RANGE_RULES = { "R5,C0,M1,S34..58,B34..45,NM", "R7,C0,M1,S100..200,B75..170,NM", "R2,C4,M0,S3..6,B4..5,NM" };
+
+// Non-totalistic rules run by --verify besides RULES, which between them use every Hensel letter for births and survivals
+const vector<string> VERIFY_HENSEL_RULES = { "B2ek3ijn4tz5cr/S1c2ain3ery4ceaiw6k", "B2ain3acqry4kiny/S1e2cek3aijkn4rtz5y",
+	"B2c3ck4aceqrw6ei/S2n3cq4kny5aeijknqr7c" };
+
+// Select ruleset to use (a loaded pattern may replace it with the rule in its header)
+string ruleName = "Conway's Game of Life";
+ruleSet rules = RULES[ruleName];
+
+// B0 rules turn the infinite background on, so while it is on the universe is stored as its complement and drawn inverted.
+// compileRule() builds the table of next states for the stored cells in each case, neither of which has B0.
+bool inverted = false;					// Set while cells holds the complement of the universe
+Uint8 phaseTables[2][512];				// Next state of a stored cell by 3x3 neighborhood, by inverted
+bool phaseInverts[2] = { false, false };	// Value of inverted after a generation, by inverted before it
 
 map<cellLoc, cellData> cells;
-set<cellLoc> cellsToUpdate, cellsToRemove;
+vector<cellLoc> cellsToUpdate, cellsToRemove;
 
 int frame = 0;
 int liveCells = 0;
+map<int, int> rowCounts, columnCounts;	// Cells not in state 0 by row (y) and by column (x), brought up to date by syncOccupancy(); the first and last keys are the bounding box
+bool occupancyTracked = false;			// Whether rowCounts and columnCounts are being kept, which starts when the bounding box is first asked for
+vector<stateChange> occupancyChanges;	// Changes between empty and occupied since then, not yet counted
+xoshiro256 rng;
+thread exportThread;		// Background pattern writer
+
+// Live cells by 64x64 tile, kept up to date by trackChange() for copy-on-write checkpoint snapshots
+map<cellLoc, shared_ptr<cowTile>> tiles;
+thread checkpointThread;
+atomic<bool> checkpointBusy(false);		// Set while checkpointThread still holds a snapshot
+int snapshotEpoch = 0;
+int checkpointCopies = 0;				// Tiles copied because they changed while the latest snapshot was shared
+atomic<double> checkpointRate(0);		// MB/s achieved by the last checkpoint write
+
+// Cell edits queued by the mouse, applied together by applyEdits() once per frame
+map<cellLoc, int> pendingEdits;
+int brushState = 1;		// State painted by the current stroke
+cellLoc lastBrush = { 0, 0 };
+
+// Rewind history: oldest first, always starting with a keyframe
+deque<historyFrame> history;
+vector<cellLoc> currentChanges;		// Cells toggled since the last history entry
+size_t historyBytes = 0;
+bool replaying = false;				// Set while seekHistory() rebuilds the universe, so it is not recorded
+double seekTime = -1;				// Milliseconds taken by the last seek
+
+// Live set hashes. zobristHash is kept up to date by trackChange(); the shape hash and centroid only serve cycle detection, so
+// they are brought up to date by syncShape() when it asks for them.
+Uint64 zobristHash = 0;			// XOR of cellKey() over live cells
+Uint64 shapeHash = 0;			// Sum of HASH_BASE[0]^x * HASH_BASE[1]^y over live cells; translating by (dx, dy) multiplies it by HASH_BASE[0]^dx * HASH_BASE[1]^dy
+Sint64 sumX = 0, sumY = 0;		// Coordinate sums for the centroid, which normalizes shapeHash for translation
+bool shapeTracked = false;		// Whether shapeHash and the sums are being kept, which starts when cycle detection first asks for them
+vector<stateChange> shapeChanges;	// Changes since then, not yet folded in
+vector<Uint64> axisPowers[2];	// HASH_BASE[axis]^coordinate by its top 16 bits (the first 65536) and its bottom 16 bits (the rest)
+
+// Cycle detection
+unordered_map<Uint64, recentState> recentStates, recentShapes;
+deque<pair<Uint64, Uint64>> recentOrder;	// Keys of the remembered generations, oldest first
+cycleInfo cycle = { 0, 0, 0 };
+
+// Per tile activity, so settled tiles can sleep instead of being evaluated cell by cell
+map<cellLoc, tileActivity> activity;
+bool inStep = false;				// Set while stepGeneration() applies a generation's updates; other changes wake their tiles
+int awakeTiles = 0;					// Tiles evaluated in the last generation
+
+// Bounded universes: a boundsW x boundsH box with its top left cell at boundsCorner. The map engine steps them on a dense engine's
+// bit array and mirrors the changes into cells.
+int topology = 0;					// 0 = the unbounded plane, else TOPOLOGY_*; set with --torus, --klein or --plane
+int boundsW = 0, boundsH = 0;
+cellLoc boundsCorner = { 0, 0 };
+
+// The rule as compiled for the dense engine, which has no complemented background
+Uint16 denseBirth = 0, denseSurvive = 0;	// Totalistic rules as masks by neighbor count, evaluated 64 cells at a time
+Uint8 denseTable[512];					// Non-totalistic rules by 3x3 neighborhood, evaluated cell by cell
+bool denseTotalistic = true;
+
+// Event scheduling
+Uint64 perfFrequency = 1;
+Uint64 idleTicks = 0;		// Time spent blocked waiting for events in the current stats window
+Uint64 statsStart = 0;		// Start of the current stats window
+double cpuLoad = 0;			// Fraction of the last stats window spent doing work rather than waiting
+
+// Session recording (--record) and replay (--replay). A session file is SESSION_MAGIC, the random seed, the command line options,
+// then the records, all in native byte order; replaying it from the same start re-runs the session exactly.
+ofstream sessionOut;					// Session being recorded
+vector<sessionRecord> sessionRecords;	// Session being replayed
+size_t sessionNext = 0;					// Next record to replay
+bool sessionReplay = false;				// Set until every record has been replayed
+int sessionEvents = 0, sessionSteps = 0;	// Events handled and generations stepped by the replay
+Uint64 sessionStart = 0;
+
+// Video export (--video): every VIDEO_EVERY generations the main loop copies the screen into videoFrames, and videoThread
+// writes the copies out as a Y4M video or numbered BMP images, so encoding only holds up the simulation once it falls VIDEO_QUEUE frames behind
+string videoPath;
+ofstream videoOut;						// Y4M video being written
+thread videoThread;
+mutex videoLock;						// Guards everything below
+condition_variable videoReady;			// Signalled when a frame is queued or taken, and when the export ends
+deque<SDL_Surface*> videoFrames;		// Copies waiting to be written, oldest first
+vector<SDL_Surface*> videoSpare;		// Written copies, reused for later frames
+bool videoDone = false;					// Set when no more frames will be queued
+int videoWritten = 0;
+Uint64 videoWaitTicks = 0;				// Time the simulation has spent waiting for room in the queue
+Uint64 stepPhaseTicks[3] = { 0, 0, 0 };	// Time stepGeneration() has spent evaluating, updating and removing cells, for --bench
 
 // Function declarations
+bool adaptEngine(Uint64 ticks);
+void addCells(vector<cellLoc>& live);
+void applyEdits();
+int applyRule(const ruleSet& r, int neighborhood);
+Uint64 axisPower(int axis, int coord);
+bool benchTrial(engine* e, const vector<cellLoc>& start, benchResult& result);
+Uint64 cellKey(int x, int y);
+int cellState(cellLoc cell);
+void clearUniverse();
+int compareBenchmark(const string& path, const vector<benchResult>& results);
+void compileRule();
+double confidence(const vector<double>& samples, double& interval);
 void createRandom();
+void createSoup(cellLoc corner, int w, int h, double density);
+void decodeChanges(const vector<Uint8>& changes, set<cellLoc>& live);
+bool detectCycle();
 void drawCell(int x, int y, int state);
+void drawPosterBand(cellLoc low, cellLoc high, int scale, bool bgr, vector<Uint8>& pixels);
+void editCells(map<cellLoc, int>& edits);
+void endTileGeneration();
+vector<Uint8> encodeChanges(vector<cellLoc>& changed);
+double engineWork(int index, Sint64 population, Sint64 changes, cellLoc low, cellLoc high);
+void exportPattern(const string& path, bool macrocell);
+void expandMacrocell(const vector<mcNode>& nodes, int node, int x, int y, vector<cellLoc>& batch);
+void fastForward(int generations);
+void fillCell(int x, int y, color c);
+engine* findEngine(const string& name);
+void finishReplay();
+void finishVideo();
+void fitView();
+Sint64 floorDiv(Sint64 a, Sint64 b);
+void handleEvent(SDL_Event& event, bool& running, bool& paused, bool& singleFrame, double fps);
+char henselLetter(int neighborhood);
+bool inBounds(int x, int y);
+Uint64 invariantHash();
+string jsonField(const string& line, const string& key);
+string jsonQuote(const string& text);
+bool loadCheckpoint(const char* p, size_t size);
+bool loadMacrocell(const char* p, const char* end);
+bool loadPattern(const string& path);
+bool loadRLE(const char* p, const char* end);
 void moveScreen(cellLoc centerPoint);
+int msUntil(Uint64 deadline);
+Uint64 mulMod(Uint64 a, Uint64 b);
+int neighborBit(int dx, int dy);
+bool optionNumber(const string& option, const string& text, Sint64 low, Sint64 high, Sint64& value);
+void paintStroke(cellLoc mousePos);
+vector<cellLoc> patternCells(const vector<string>& rows);
+Uint64 powMod(Uint64 base, Sint64 exponent);
+void pushKeyframe(historyFrame& entry);
+bool parseCounts(const string& text, set<int>& counts, map<int, string>& letters);
+bool parseInteger(const string& text, Sint64 low, Sint64 high, Sint64& value);
+bool parseRangeRule(const string& rule, ruleSet& parsed);
+bool parseRule(const string& text, ruleSet& parsed);
+void queueBrush(cellLoc cell);
+void queueVideoFrame();
+vector<cellLoc> randomSoup(int size, double density);
+bool readSession(const string& path, vector<string>& args);
+void recordSession(Uint8 kind, const SDL_Event* event);
+void recordHistory();
 void removeCells();
+bool replaySession(bool& running, bool& paused, bool& singleFrame, double fps);
+string ruleString(const ruleSet& r);
+int runBenchmark(const string& path, const string& baseline, const string& patternFile);
+int runLatency(Sint64 maxCells);
+int runScaling(const string& path, Sint64 maxCells);
+int runVerify(int generations);
+void resetCycles();
+void resetHistory();
+void saveCheckpoint(const string& path);
+bool scaleRun(engine* e, Sint64 live, int threads, scalePoint& point, double& seconds);
+cellLoc screenToCell(cellLoc mousePos);
+bool seekHistory(int target);
+void setBoundedNextState();
 void setNextState();
+void setRangeNextState();
+bool setRule(const string& text);
+bool setTopology(int kind, const string& size);
+void showStats(double fps);
+vector<Uint64> soupBits(int w, int h, double density);
+int splitTile(cellLoc tileLoc, const cowTile& tile, checkpointTile* blocks);
+void stepGeneration();
+bool switchEngine(engine* next);
+void syncOccupancy();
+void syncShape();
+bool verifyCheckpoint(const string& rule);
+bool verifyRun(const string& label, vector<cellLoc> start, int generations);
 void toggleCell(cellLoc mousePos);
-void updateCell(cellLoc cell);
-
-// Graphics
-SDL_Window* window = NULL;
-SDL_Surface* surface = NULL;
+void trackActivity(int x, int y);
+void trackChange(int x, int y, int from, int to);
+void updateCell(map<cellLoc, cellData>::iterator cell);
+void writeCheckpoint(const string& path, map<cellLoc, shared_ptr<cowTile>> snapshot, checkpointHeader header, string rule);
+void writeMacrocell(const string& path, vector<cellLoc> live, string rule, int gen);
+bool writePoster(const string& path, int scale);
+void writeRLE(const string& path, vector<cellLoc> live, string rule, int gen);
+void writeVideo(string path);
 
+// The engine behind the free functions: cells stored sparsely in a map with their neighborhoods, updated incrementally as
+// they change. It is the full featured one, keeping the history, checkpoint tiles, hashes and sleeping tiles up to date as it
+// steps, and there is only one, as its state is the globals above.
+struct mapEngine : engine
+{
+	string name()
+	{
+		return "map";
+	}
 
-long timediff(clock_t t1, clock_t t2) {
-	long elapsed;
-	elapsed = ((long)t2 - t1) / CLOCKS_PER_SEC * 1000;
-	return elapsed;
-}
+	bool supports(const ruleSet& r)
+	{
+		// A bounded universe is stepped on a bit array with a 3x3 neighborhood
+		return topology == 0 || (r.states == 2 && r.range == 1);
+	}
 
+	void clear()
+	{
+		clearUniverse();
+	}
 
-void createRandom()
-{
-	int gridX, gridY;
-	// Create random cells within visible window
-	for (int i = 0; i < numCols * numRows; i++)
+	void step(int generations)
 	{
-		gridX = (rand() % numCols) + topLeft.x;
-		gridY = (rand() % numRows) + topLeft.y;
-		if (cells.find({ gridX, gridY }) == cells.end())
-		{
-			cells[{gridX, gridY}] = { 1, 1, 0 };
-		}
-		else
+		for (int i = 0; i < generations; i++)
 		{
-			cells[{gridX, gridY}].nextState = 1 - cells[{gridX, gridY}].currState;
+			stepGeneration();
 		}
-		updateCell({ gridX, gridY });
 	}
-	SDL_UpdateWindowSurface(window);
-}
 
-void drawCell(int x, int y, int state)
-{
-	// No need to draw if cell does not appear in the window
-	if (x >= topLeft.x && x < (topLeft.x + numCols) && y >= topLeft.y && y < (topLeft.y + numRows))
+	int getCell(cellLoc cell)
 	{
-		// Calculate screen offsets
-		int screen_x = (x - topLeft.x); // *(CELL_SIZE + 1);
-		int screen_y = (y - topLeft.y); // *(CELL_SIZE + 1);
+		map<cellLoc, cellData>::iterator it = cells.find(cell);
+		return it == cells.end() ? 0 : it->second.currState;
+	}
 
-		// Draw the cell
-		Uint8* pixel_ptr = (Uint8*)surface->pixels + (screen_y * (CELL_SIZE + 1) * WIDTH + screen_x * (CELL_SIZE + 1)) * 4;
+	void setCell(cellLoc cell, int state)
+	{
+		map<cellLoc, int> edit = { { cell, state } };
+		editCells(edit);
+	}
 
-		for (unsigned int i = 0; i < CELL_SIZE; i++)
+	void load(vector<cellLoc>& live)
+	{
+		addCells(live);
+	}
+
+	void viewport(cellLoc low, cellLoc high, vector<pair<cellLoc, int>>& out)
+	{
+		// cells is ordered by x, then y, so each column's cells in range are found by a seek to its first one rather than by
+		// walking past the rest of the column, which keeps a short wide range (a poster band) quick
+		map<cellLoc, cellData>::iterator it = cells.lower_bound(low);
+		while (it != cells.end() && it->first.x < high.x)
 		{
-			for (unsigned int j = 0; j < CELL_SIZE; j++)
+			if (it->first.y < low.y)
 			{
-				*(pixel_ptr + j * 4) = colors[state].r;
-				*(pixel_ptr + j * 4 + 1) = colors[state].g;
-				*(pixel_ptr + j * 4 + 2) = colors[state].b;
+				it = cells.lower_bound({ it->first.x, low.y });
+			}
+			else if (it->first.y >= high.y)
+			{
+				it = cells.lower_bound({ it->first.x + 1, low.y });
+			}
+			else
+			{
+				if (it->second.currState != 0)
+				{
+					out.push_back({ it->first, (int)it->second.currState });
+				}
+				it++;
 			}
-			pixel_ptr += WIDTH * 4;
 		}
 	}
-}
 
-void moveScreen(cellLoc centerPoint)
-{
-	numRows = HEIGHT / (CELL_SIZE + 1);
-	numCols = WIDTH / (CELL_SIZE + 1);
-	topLeft = { (centerPoint.x - (numCols / 2)), (centerPoint.y - (numRows / 2)) };
-	// Clear the screen
-	SDL_memset(surface->pixels, 0, surface->h * surface->pitch);
+	Sint64 population()
+	{
+		return liveCells;
+	}
 
-	// Redraw active cells
-	for (map<cellLoc, cellData>::iterator it = cells.begin(); it != cells.end(); it++)
+	Uint64 hash()
 	{
-		if (it->second.currState == 1)
+		return zobristHash;
+	}
+
+	Sint64 changes()
+	{
+		return cellsToUpdate.size();
+	}
+
+	bool bounds(cellLoc& low, cellLoc& high)
+	{
+		// The first and last occupied column and row
+		syncOccupancy();
+		if (rowCounts.empty())
 		{
-			drawCell(it->first.x, it->first.y, 1);
+			return false;
 		}
+		low = { columnCounts.begin()->first, rowCounts.begin()->first };
+		high = { columnCounts.rbegin()->first, rowCounts.rbegin()->first };
+		return true;
 	}
-	SDL_UpdateWindowSurface(window);
-}
 
-void removeCells()
+	void setThreads(int)
+	{
+		// Every update goes through the globals, so a generation runs on one thread (bar a bounded universe's bit array)
+	}
+
+	size_t memory()
+	{
+		// Each tree node holds its value, three pointers and a colour
+		const size_t node = 4 * sizeof(void*);
+		size_t bytes = cells.size() * (sizeof(pair<const cellLoc, cellData>) + node) +
+			tiles.size() * (sizeof(pair<const cellLoc, shared_ptr<cowTile>>) + node + sizeof(cowTile) + 2 * sizeof(void*)) +
+			activity.size() * (sizeof(pair<const cellLoc, tileActivity>) + node) +
+			(rowCounts.size() + columnCounts.size()) * (sizeof(pair<const int, int>) + node) +
+			(cellsToUpdate.capacity() + cellsToRemove.capacity()) * sizeof(cellLoc) +
+			currentChanges.capacity() * sizeof(cellLoc) + historyBytes;
+		return bytes;
+	}
+};
+
+// Dense engine: the universe as a box of bits, 64 cells per word, stepped from one buffer into the other. A bounded universe's
+// box is fixed; on the unbounded plane the box grows whenever the pattern comes within a cell of its edge, so the cells outside
+// it stay dead. It runs two state rules with a 3x3 neighborhood.
+struct denseEngine : engine
 {
-	// Remove inactive cells with no neighbors
-	for (set<cellLoc>::iterator loc = cellsToRemove.begin(); loc != cellsToRemove.end(); loc++)
+	cellLoc corner = { 0, 0 };				// Top left cell of the box
+	int width = 0, height = 0, words = 0;	// Size of the box, and words per row
+	bool fixed = false;						// Set for a bounded universe
+	vector<Uint64> bits[2];					// Current generation [0] and the one before [1]; bit x & 63 of word y * words + x / 64 is cell (x, y) of the box
+	void (denseEngine::*stepBox)(int, int) = NULL;	// stepRows() for the box's size
+	int threads = 1;						// Bands of rows a large box is split into, each stepped on its own thread
+
+	string name()
+	{
+		return "dense";
+	}
+
+	bool supports(const ruleSet& r)
+	{
+		// B0 would turn on the infinite background, which only a bounded box can hold
+		return r.states == 2 && r.range == 1 && (topology != 0 || r.birthList.count(0) == 0);
+	}
+
+	void clear()
 	{
-		if (cells.find(*loc) != cells.end() && cells[*loc].currState == 0 && cells[*loc].numNeighbors == 0)
+		// Empty the box: the bounded universe's, or a small one around the origin to grow from
+		fixed = topology != 0;
+		if (fixed)
 		{
-			cells.erase(*loc);
+			resize(boundsCorner, boundsW, boundsH, false);
+		}
+		else
+		{
+			resize({ -32, -32 }, 64, 64, false);
 		}
 	}
-}
 
-void setNextState()
-{
-	for (map<cellLoc, cellData>::iterator it = cells.begin(); it != cells.end(); it++)
+	void step(int generations)
 	{
-		if (it->second.currState == 1)
+		for (int i = 0; i < generations; i++)
 		{
-			if (rules.surviveList.find(it->second.numNeighbors) == rules.surviveList.end())
+			if (!fixed)
 			{
-				it->second.nextState = 0;
-				cellsToUpdate.insert(it->first);
+				growToEdges();
 			}
+			stepBands();
+			bits[0].swap(bits[1]);
 		}
-		else if (rules.birthList.find(it->second.numNeighbors) != rules.birthList.end())
+	}
+
+	int getCell(cellLoc cell)
+	{
+		int x = cell.x - corner.x, y = cell.y - corner.y;
+		if (x < 0 || y < 0 || x >= width || y >= height)
 		{
-			it->second.nextState = 1;
-			cellsToUpdate.insert(it->first);
+			return 0;
 		}
+		return (int)((bits[0][(size_t)y * words + x / 64] >> (x & 63)) & 1);
 	}
-}
 
-void toggleCell(cellLoc mousePos)
-{
-	int x = mousePos.x / (CELL_SIZE + 1) + topLeft.x;
-	int y = mousePos.y / (CELL_SIZE + 1) + topLeft.y;
-	if (cells.find({ x, y }) == cells.end())
+	void setCell(cellLoc cell, int state)
 	{
-		// Create new cell
-		cells[{x, y}] = { 1, 1, 0 };
+		if (!fixed)
+		{
+			include(cell, cell);
+		}
+		int x = cell.x - corner.x, y = cell.y - corner.y;
+		if (x < 0 || y < 0 || x >= width || y >= height)
+		{
+			return;
+		}
+		Uint64& word = bits[0][(size_t)y * words + x / 64];
+		word = (state != 0) ? (word | (1ull << (x & 63))) : (word & ~(1ull << (x & 63)));
 	}
-	else
+
+	void load(vector<cellLoc>& live)
 	{
-		cells[{x, y}].nextState = 1 - cells[{x, y}].currState;
+		// Grow the box once for the whole batch
+		if (!fixed && !live.empty())
+		{
+			cellLoc low = live[0], high = live[0];
+			for (size_t i = 1; i < live.size(); i++)
+			{
+				low = { min(low.x, live[i].x), min(low.y, live[i].y) };
+				high = { max(high.x, live[i].x), max(high.y, live[i].y) };
+			}
+			include(low, high);
+		}
+		for (size_t i = 0; i < live.size(); i++)
+		{
+			setCell(live[i], 1);
+		}
 	}
-	updateCell({ x, y });
-	removeCells();
-	SDL_UpdateWindowSurface(window);
-}
 
-void updateCell(cellLoc cell)
-{
-	int x0 = cell.x, y0 = cell.y;
-	cells[cell].currState = cells[cell].nextState;
-	// Update each of current cell's neighbors' num_neighbors based on current cell's state
-	if (cells[cell].currState == 1)
+	void viewport(cellLoc low, cellLoc high, vector<pair<cellLoc, int>>& out)
 	{
-		for (int y = y0 - 1; y < y0 + 2; y++)
+		Sint64 y0 = max((Sint64)low.y - corner.y, (Sint64)0), y1 = min((Sint64)high.y - corner.y, (Sint64)height);
+		Sint64 x0 = max((Sint64)low.x - corner.x, (Sint64)0), x1 = min((Sint64)high.x - corner.x, (Sint64)width);
+		for (Sint64 y = y0; y < y1; y++)
 		{
-			for (int x = x0 - 1; x < x0 + 2; x++)
+			for (Sint64 i = x0 / 64; i * 64 < x1; i++)
 			{
-				if (cells.find({ x, y }) == cells.end())
-				{
-					// if cell doesn't exist, create cell for neighbor
-					cells[{x, y}] = { 0, 0, 1 };
-				}
-				else
+				for (Uint64 word = bits[0][(size_t)y * words + i]; word != 0; word &= word - 1)
 				{
-					// Add 1 to neighbor count
-					cells[{x, y}].numNeighbors++;
+					Sint64 x = i * 64 + (int)bitset<64>((word & (0 - word)) - 1).count();
+					if (x >= x0 && x < x1)
+					{
+						out.push_back({ { (int)(corner.x + x), (int)(corner.y + y) }, 1 });
+					}
 				}
 			}
 		}
-		cells[{x0, y0}].numNeighbors--;  // Don't count self
-		liveCells++;
 	}
-	else
+
+	Sint64 population()
 	{
-		for (int y = y0 - 1; y < y0 + 2; y++)
+		Sint64 count = 0;
+		for (size_t i = 0; i < bits[0].size(); i++)
 		{
-			for (int x = x0 - 1; x < x0 + 2; x++)
+			count += bitset<64>(bits[0][i]).count();
+		}
+		return count;
+	}
+
+	Uint64 hash()
+	{
+		Uint64 h = 0;
+		for (int y = 0; y < height; y++)
+		{
+			for (int i = 0; i < words; i++)
+			{
+				for (Uint64 word = bits[0][(size_t)y * words + i]; word != 0; word &= word - 1)
+				{
+					h ^= cellKey(corner.x + i * 64 + (int)bitset<64>((word & (0 - word)) - 1).count(), corner.y + y);
+				}
+			}
+		}
+		return h;
+	}
+
+	Sint64 changes()
+	{
+		Sint64 count = 0;
+		for (size_t i = 0; i < bits[0].size(); i++)
+		{
+			count += bitset<64>(bits[0][i] ^ bits[1][i]).count();
+		}
+		return count;
+	}
+
+	bool bounds(cellLoc& low, cellLoc& high)
+	{
+		low = { INT_MAX, INT_MAX };
+		high = { INT_MIN, INT_MIN };
+		for (int y = 0; y < height; y++)
+		{
+			for (int i = 0; i < words; i++)
+			{
+				Uint64 word = bits[0][(size_t)y * words + i];
+				if (word != 0)
+				{
+					int first = (int)bitset<64>((word & (0 - word)) - 1).count(), last = 63;
+					while (!((word >> last) & 1))
+					{
+						last--;
+					}
+					low = { min(low.x, corner.x + i * 64 + first), min(low.y, corner.y + y) };
+					high = { max(high.x, corner.x + i * 64 + last), max(high.y, corner.y + y) };
+				}
+			}
+		}
+		return low.x <= high.x;
+	}
+
+	void setThreads(int count)
+	{
+		threads = max(count, 1);
+	}
+
+	size_t memory()
+	{
+		return (bits[0].capacity() + bits[1].capacity()) * sizeof(Uint64);
+	}
+
+	void stepBands()
+	{
+		// One generation, in a band of rows per thread if the box is big enough for each band to outweigh starting its thread.
+		// Bands only write their own rows of bits[1], so they need no locking.
+		int bands = (int)min<Sint64>(threads, min<Sint64>((Sint64)width * height / DENSE_BAND_CELLS, height));
+		if (bands <= 1)
+		{
+			(this->*stepBox)(0, height);
+			return;
+		}
+		vector<thread> workers;
+		for (int b = 1; b < bands; b++)
+		{
+			workers.push_back(thread(stepBox, this, (int)((Sint64)height * b / bands), (int)((Sint64)height * (b + 1) / bands)));
+		}
+		(this->*stepBox)(0, height / bands);
+		for (size_t w = 0; w < workers.size(); w++)
+		{
+			workers[w].join();
+		}
+	}
+
+	void resize(cellLoc newCorner, int newWidth, int newHeight, bool keep)
+	{
+		// Move the box, keeping the cells inside both if keep is set. Unbounded boxes move by whole words, so rows copy word by word.
+		int newWords = (newWidth + 63) / 64;
+		vector<Uint64> moved((size_t)newWords * newHeight, 0);
+		if (keep)
+		{
+			int shiftWords = (corner.x - newCorner.x) / 64, shiftRows = corner.y - newCorner.y;
+			for (int y = 0; y < height; y++)
+			{
+				copy(bits[0].begin() + (size_t)y * words, bits[0].begin() + (size_t)(y + 1) * words, moved.begin() + (size_t)(y + shiftRows) * newWords + shiftWords);
+			}
+		}
+		bits[0].swap(moved);
+		bits[1].assign(bits[0].size(), 0);
+		corner = newCorner;
+		width = newWidth;
+		height = newHeight;
+		words = newWords;
+
+		// Sizes used often get a stepRows() of their own
+		if (width == 256 && height == 256)
+		{
+			stepBox = &denseEngine::stepRows<256, 256>;
+		}
+		else if (width == 512 && height == 512)
+		{
+			stepBox = &denseEngine::stepRows<512, 512>;
+		}
+		else if (width == 1024 && height == 1024)
+		{
+			stepBox = &denseEngine::stepRows<1024, 1024>;
+		}
+		else if (width == 2048 && height == 2048)
+		{
+			stepBox = &denseEngine::stepRows<2048, 2048>;
+		}
+		else
+		{
+			stepBox = &denseEngine::stepRows<0, 0>;
+		}
+	}
+
+	void include(cellLoc low, cellLoc high)
+	{
+		// Grow an unbounded box so cells low to high have a dead cell between them and its edges, by at least half its size on
+		// each side that grows so that a growing pattern resizes it only now and then
+		Sint64 left = 0, right = 0, top = 0, bottom = 0;
+		if (low.x <= corner.x)
+		{
+			left = ((Sint64)corner.x - low.x + 1 + width / 2 + 63) / 64 * 64;
+		}
+		if (high.x >= corner.x + width - 1)
+		{
+			right = ((Sint64)high.x - (corner.x + width - 1) + 1 + width / 2 + 63) / 64 * 64;
+		}
+		if (low.y <= corner.y)
+		{
+			top = (Sint64)corner.y - low.y + 1 + height / 2;
+		}
+		if (high.y >= corner.y + height - 1)
+		{
+			bottom = (Sint64)high.y - (corner.y + height - 1) + 1 + height / 2;
+		}
+		if (left + right + top + bottom == 0)
+		{
+			return;
+		}
+		if (width + left + right > MAX_DENSE || height + top + bottom > MAX_DENSE)
+		{
+			cout << "Dense box would pass " << MAX_DENSE << " cells across, so cells beyond it are lost" << endl;
+			return;
+		}
+		resize({ (int)(corner.x - left), (int)(corner.y - top) }, (int)(width + left + right), (int)(height + top + bottom), true);
+	}
+
+	void growToEdges()
+	{
+		// Grow the box on each side where a live cell has reached the edge
+		bool edges[4] = { false, false, false, false };	// W, E, N, S
+		for (int i = 0; i < words; i++)
+		{
+			edges[2] = edges[2] || bits[0][i] != 0;
+			edges[3] = edges[3] || bits[0][(size_t)(height - 1) * words + i] != 0;
+		}
+		for (int y = 0; y < height; y++)
+		{
+			edges[0] = edges[0] || (bits[0][(size_t)y * words] & 1) != 0;
+			edges[1] = edges[1] || (bits[0][(size_t)y * words + words - 1] >> 63) != 0;
+		}
+		if (edges[0] || edges[1] || edges[2] || edges[3])
+		{
+			include({ edges[0] ? corner.x : corner.x + 1, edges[2] ? corner.y : corner.y + 1 },
+				{ edges[1] ? corner.x + width - 1 : corner.x + width - 2, edges[3] ? corner.y + height - 1 : corner.y + height - 2 });
+		}
+	}
+
+	template<int W, int H> void stepRows(int firstRow, int endRow)
+	{
+		// Rows firstRow up to endRow of the next generation, from bits[0] into bits[1], 64 cells per word. Common sizes are
+		// instantiated with W and H fixed, so the row and wrap arithmetic folds to constants; otherwise both are 0 and the size
+		// is read from width and height.
+		const int boxWidth = W ? W : width, boxHeight = H ? H : height;
+		const int rowWords = (boxWidth + 63) / 64;
+		const int lastBits = boxWidth - (rowWords - 1) * 64;
+		const Uint64 lastMask = lastBits == 64 ? ~0ull : (1ull << lastBits) - 1;
+		const bool wraps = fixed && topology != TOPOLOGY_PLANE;
+		const Uint64* current = bits[0].data();
+		Uint64* next = bits[1].data();
+
+		// Counts that turn a cell on: bit 0 of the mask if it is dead, bit 1 if alive
+		int counts[9], masks[9], countsUsed = 0;
+		for (int count = 0; count <= 8; count++)
+		{
+			int mask = ((denseBirth >> count) & 1) | ((denseSurvive >> count) & 1) << 1;
+			if (mask != 0)
+			{
+				counts[countsUsed] = count;
+				masks[countsUsed++] = mask;
+			}
+		}
+
+		// The rows beyond the top and bottom edges: empty unless the box wraps, when they are the opposite edge, reflected for a Klein bottle
+		vector<Uint64> beyond[2] = { vector<Uint64>(rowWords, 0), vector<Uint64>(rowWords, 0) };
+		for (int edge = 0; edge < 2 && wraps; edge++)
+		{
+			const Uint64* row = current + (size_t)(edge ? 0 : boxHeight - 1) * rowWords;
+			for (int x = 0; x < boxWidth; x++)
+			{
+				int from = topology == TOPOLOGY_KLEIN ? boxWidth - 1 - x : x;
+				beyond[edge][x / 64] |= ((row[from / 64] >> (from & 63)) & 1) << (x & 63);
+			}
+		}
+
+		for (int y = firstRow; y < endRow; y++)
+		{
+			const Uint64* rows[3] = {
+				y > 0 ? current + (size_t)(y - 1) * rowWords : beyond[0].data(),
+				current + (size_t)y * rowWords,
+				y < boxHeight - 1 ? current + (size_t)(y + 1) * rowWords : beyond[1].data() };
+			for (int i = 0; i < rowWords; i++)
+			{
+				// The 3x3 neighborhood of each of the word's cells, in cellData::neighbors order. West and east bring in the next
+				// word's edge bit, or at the ends of the row the opposite end's if it wraps.
+				Uint64 n[9];
+				for (int r = 0; r < 3; r++)
+				{
+					const Uint64* row = rows[r];
+					Uint64 westIn = i > 0 ? row[i - 1] >> 63 : (wraps ? (row[rowWords - 1] >> (lastBits - 1)) & 1 : 0);
+					Uint64 eastIn = i < rowWords - 1 ? row[i + 1] << 63 : (wraps ? (row[0] & 1) << (lastBits - 1) : 0);
+					n[r * 3] = (row[i] << 1) | westIn;
+					n[r * 3 + 1] = row[i];
+					n[r * 3 + 2] = (row[i] >> 1) | eastIn;
+				}
+
+				Uint64 result = 0;
+				if (denseTotalistic)
+				{
+					// Add up the eight neighbors as a 4 bit count per cell: a full adder per row, then the carries
+					Uint64 upSum = n[0] ^ n[1] ^ n[2], upCarry = (n[0] & n[1]) | (n[2] & (n[0] ^ n[1]));
+					Uint64 midSum = n[3] ^ n[5], midCarry = n[3] & n[5];
+					Uint64 downSum = n[6] ^ n[7] ^ n[8], downCarry = (n[6] & n[7]) | (n[8] & (n[6] ^ n[7]));
+					Uint64 ones = upSum ^ midSum ^ downSum, onesCarry = (upSum & midSum) | (downSum & (upSum ^ midSum));
+					Uint64 twosSum = upCarry ^ midCarry ^ downCarry, twosCarry = (upCarry & midCarry) | (downCarry & (upCarry ^ midCarry));
+					Uint64 twos = twosSum ^ onesCarry, fours = twosCarry ^ (twosSum & onesCarry), eights = twosCarry & twosSum & onesCarry;
+					for (int c = 0; c < countsUsed; c++)
+					{
+						int count = counts[c];
+						Uint64 match = ((count & 1) ? ones : ~ones) & ((count & 2) ? twos : ~twos) & ((count & 4) ? fours : ~fours) & ((count & 8) ? eights : ~eights);
+						result |= match & (masks[c] == 3 ? ~0ull : (masks[c] == 2 ? n[4] : ~n[4]));
+					}
+				}
+				else
+				{
+					for (int bit = 0; bit < 64; bit++)
+					{
+						int neighborhood = 0;
+						for (int k = 0; k < 9; k++)
+						{
+							neighborhood |= (int)((n[k] >> bit) & 1) << k;
+						}
+						result |= (Uint64)denseTable[neighborhood] << bit;
+					}
+				}
+				next[(size_t)y * rowWords + i] = i == rowWords - 1 ? result & lastMask : result;
+			}
+		}
+	}
+};
+
+// Reference engine for --verify: the rule applied as written to every cell near a stored one, with nothing carried between
+// generations but the cells, so every rule the other engines run has something to be checked against. Like the map engine it
+// stores the complement of the universe while a B0 rule has the background on, but it tracks the background itself.
+struct referenceEngine : engine
+{
+	map<cellLoc, int> stored;		// Cells whose state differs from the background, by state (1 for every one while it is on)
+	bool background = false;
+	Sint64 changed = 0;
+
+	string name()
+	{
+		return "reference";
+	}
+
+	bool supports(const ruleSet&)
+	{
+		// Every rule, but only on an unbounded universe
+		return topology == 0;
+	}
+
+	char letter(int neighborhood)
+	{
+		// Hensel letter of the eight cells around the center, found by turning and flipping their picture until it matches
+		// one in HENSEL_PICTURES. Counts above 4 take the letter of their complement.
+		string picture(9, '.');
+		int count = 0;
+		for (int i = 0; i < 9; i++)
+		{
+			if (i != 4 && ((neighborhood >> i) & 1))
+			{
+				picture[i] = 'o';
+				count++;
+			}
+		}
+		if (count > 4)
+		{
+			for (int i = 0; i < 9; i++)
+			{
+				picture[i] = i == 4 ? '.' : (picture[i] == 'o' ? '.' : 'o');
+			}
+			count = 8 - count;
+		}
+		for (int symmetry = 0; symmetry < 8; symmetry++)
+		{
+			for (map<string, string>::const_iterator it = HENSEL_PICTURES.begin(); it != HENSEL_PICTURES.end(); it++)
+			{
+				if (it->first[0] - '0' == count && it->second == picture)
+				{
+					return it->first[1];
+				}
+			}
+
+			// A quarter turn, then a flip after the fourth
+			string turned(9, '.');
+			for (int row = 0; row < 3; row++)
+			{
+				for (int column = 0; column < 3; column++)
+				{
+					turned[row * 3 + column] = symmetry == 3 ? picture[row * 3 + 2 - column] : picture[(2 - column) * 3 + row];
+				}
+			}
+			picture = turned;
+		}
+		return 0;
+	}
+
+	bool survives(int neighborhood, bool alive)
+	{
+		// Whether a two state cell is on next generation, from the rule as written: its count, then its letter if the count has any
+		int count = (int)bitset<9>(neighborhood & 0x1EF).count();
+		if ((alive ? rules.surviveList : rules.birthList).count(count) == 0)
+		{
+			return false;
+		}
+		const map<int, string>& letters = alive ? rules.surviveLetters : rules.birthLetters;
+		map<int, string>::const_iterator limited = letters.find(count);
+		return limited == letters.end() || limited->second.find(letter(neighborhood)) != string::npos;
+	}
+
+	void clear()
+	{
+		stored.clear();
+		background = false;
+		changed = 0;
+	}
+
+	void step(int generations)
+	{
+		for (int g = 0; g < generations; g++)
+		{
+			// Scatter each cell in state 1 into the neighborhoods around it: as bits of the 3x3 neighborhood (which Hensel
+			// letters need), or as counts for Larger than Life. The cell itself is added with nothing, so it is evaluated too.
+			int r = rules.range;
+			map<cellLoc, int> hoods;
+			for (map<cellLoc, int>::iterator it = stored.begin(); it != stored.end(); it++)
+			{
+				hoods[it->first];
+				if (it->second != 1)
+				{
+					continue;
+				}
+				for (int dy = -r; dy <= r; dy++)
+				{
+					for (int dx = -r; dx <= r; dx++)
+					{
+						if (dx != 0 || dy != 0)
+						{
+							hoods[{ it->first.x + dx, it->first.y + dy }] += r == 1 ? neighborBit(-dx, -dy) : 1;
+						}
+					}
+				}
+			}
+
+			// Cells beyond every neighborhood all follow the background; only 3x3 rules have B0
+			int flip = background ? 0x1EF : 0;
+			bool nextBackground = r == 1 && survives(flip, background);
+			map<cellLoc, int> next;
+			changed = 0;
+			for (map<cellLoc, int>::iterator it = hoods.begin(); it != hoods.end(); it++)
+			{
+				map<cellLoc, int>::iterator cell = stored.find(it->first);
+				int state = cell == stored.end() ? 0 : cell->second;
+				int actual = rules.states > 2 ? state : state ^ (int)background;
+				int after;
+				if (actual > 1)
+				{
+					after = (actual + 1) % rules.states;
+				}
+				else
+				{
+					bool on = r == 1 ? survives(it->second ^ flip, actual == 1) :
+						(actual ? rules.surviveList : rules.birthList).count(it->second) > 0;
+					after = on ? 1 : (actual == 1 && rules.states > 2 ? 2 : 0);
+				}
+				int storedAfter = rules.states > 2 ? after : after ^ (int)nextBackground;
+				if (storedAfter != 0)
+				{
+					next[it->first] = storedAfter;
+				}
+				changed += after != actual;
+			}
+			stored.swap(next);
+			background = nextBackground;
+		}
+	}
+
+	int getCell(cellLoc cell)
+	{
+		map<cellLoc, int>::iterator it = stored.find(cell);
+		return it == stored.end() ? 0 : it->second;
+	}
+
+	void setCell(cellLoc cell, int state)
+	{
+		if (state != 0)
+		{
+			stored[cell] = state;
+		}
+		else
+		{
+			stored.erase(cell);
+		}
+	}
+
+	void load(vector<cellLoc>& live)
+	{
+		for (size_t i = 0; i < live.size(); i++)
+		{
+			stored[live[i]] = 1;
+		}
+	}
+
+	void viewport(cellLoc low, cellLoc high, vector<pair<cellLoc, int>>& out)
+	{
+		for (map<cellLoc, int>::iterator it = stored.lower_bound(low); it != stored.end() && it->first.x < high.x; it++)
+		{
+			if (it->first.y >= low.y && it->first.y < high.y)
+			{
+				out.push_back(*it);
+			}
+		}
+	}
+
+	Sint64 population()
+	{
+		return stored.size();
+	}
+
+	Uint64 hash()
+	{
+		Uint64 h = 0;
+		for (map<cellLoc, int>::iterator it = stored.begin(); it != stored.end(); it++)
+		{
+			h ^= cellKey(it->first.x, it->first.y) * (2 * it->second - 1);
+		}
+		return h;
+	}
+
+	Sint64 changes()
+	{
+		return changed;
+	}
+
+	bool bounds(cellLoc& low, cellLoc& high)
+	{
+		low = { INT_MAX, INT_MAX };
+		high = { INT_MIN, INT_MIN };
+		for (map<cellLoc, int>::iterator it = stored.begin(); it != stored.end(); it++)
+		{
+			low = { min(low.x, it->first.x), min(low.y, it->first.y) };
+			high = { max(high.x, it->first.x), max(high.y, it->first.y) };
+		}
+		return low.x <= high.x;
+	}
+
+	void setThreads(int)
+	{
+	}
+
+	size_t memory()
+	{
+		return stored.size() * (sizeof(pair<const cellLoc, int>) + 4 * sizeof(void*));
+	}
+};
+
+denseEngine boundedGrid;			// The map engine's bit array for a bounded universe
+mapEngine mapUniverse;
+denseEngine denseUniverse;
+referenceEngine referenceUniverse;	// Only used by --verify
+engine* const ENGINES[2] = { &mapUniverse, &denseUniverse };
+engine* universe = &mapUniverse;	// Engine the universe runs on; set with --engine or switched with E
+
+// Adaptive engine selection (--engine auto): every ADAPT_INTERVAL generations the step time is measured and the universe moves to
+// whichever engine is predicted to be fastest by enough of a margin
+bool adaptive = false;
+Uint64 adaptTicks = 0;				// Time spent stepping since the last sample
+int adaptGenerations = 0;			// Generations stepped since the last sample
+double engineUnitCost[2] = { ADAPT_MAP_COST, ADAPT_DENSE_COST };	// Seconds per unit of engineWork(), by ENGINES index, updated while each engine runs
+double switchedFrom = 0;			// Seconds per generation before the last switch, until it has been compared with after (0 = none pending)
+
+// Graphics
+SDL_Window* window = NULL;
+SDL_Surface* surface = NULL;
+
+
+bool adaptEngine(Uint64 ticks)
+{
+	// Count a generation's step time, and at the end of each interval recalibrate the running engine's cost from the time
+	// measured and predict the others' from the pattern's population, density and change rate. Returns true if the universe moved.
+	adaptTicks += ticks;
+	if (++adaptGenerations < ADAPT_INTERVAL)
+	{
+		return false;
+	}
+	double measured = (double)adaptTicks / perfFrequency / adaptGenerations;
+	adaptTicks = 0;
+	adaptGenerations = 0;
+
+	int current = 0;
+	while (ENGINES[current] != universe)
+	{
+		current++;
+	}
+	if (switchedFrom > 0)
+	{
+		cout << "Generation " << frame << ": " << universe->name() << " engine measured " << measured * 1000 << " ms/gen after the switch, " << switchedFrom / measured << "x" << endl;
+		switchedFrom = 0;
+	}
+
+	cellLoc low, high;
+	Sint64 population = universe->population(), changes = universe->changes();
+	if (!universe->bounds(low, high))
+	{
+		return false;
+	}
+	engineUnitCost[current] = measured / max(engineWork(current, population, changes, low, high), 1.0);
+
+	int best = current;
+	double bestCost = measured;
+	for (int e = 0; e < (int)(sizeof(ENGINES) / sizeof(ENGINES[0])); e++)
+	{
+		double predicted = engineUnitCost[e] * engineWork(e, population, changes, low, high);
+		if (e != current && !inverted && ENGINES[e]->supports(rules) && predicted * ADAPT_THRESHOLD < bestCost)
+		{
+			best = e;
+			bestCost = predicted;
+		}
+	}
+	if (best == current)
+	{
+		return false;
+	}
+
+	double density = (double)population / ((double)(high.x - low.x + 1) * (high.y - low.y + 1));
+	cout << "Generation " << frame << ": " << universe->name() << " -> " << ENGINES[best]->name() << " engine (population " << population << ", density " << density <<
+		", change rate " << (double)changes / population << "): measured " << measured * 1000 << " ms/gen, predicted " << bestCost * 1000 << " ms/gen" << endl;
+	if (!switchEngine(ENGINES[best]))
+	{
+		return false;
+	}
+	switchedFrom = measured;
+	return true;
+}
+
+void addCells(vector<cellLoc>& live)
+{
+	// Bulk insert: turn on every cell in live with one sort of their neighbor contributions and one ordered merge into cells
+	if (topology != 0)
+	{
+		live.erase(remove_if(live.begin(), live.end(), [](const cellLoc& c) { return !inBounds(c.x, c.y); }), live.end());
+	}
+	sort(live.begin(), live.end());
+	live.erase(unique(live.begin(), live.end()), live.end());
+
+	vector<cellDelta> deltas;
+	deltas.reserve(live.size() * 9);
+	for (size_t i = 0; i < live.size(); i++)
+	{
+		map<cellLoc, cellData>::iterator it = cells.find(live[i]);
+		if (it != cells.end() && it->second.currState == 1)
+		{
+			continue;
+		}
+		int x0 = live[i].x, y0 = live[i].y;
+		for (int y = y0 - 1; y < y0 + 2; y++)
+		{
+			for (int x = x0 - 1; x < x0 + 2; x++)
+			{
+				deltas.push_back({ { x, y }, (x != x0 || y != y0) ? neighborBit(x0 - x, y0 - y) : 0, (x == x0 && y == y0) ? 1 : 0 });
+			}
+		}
+	}
+	sort(deltas.begin(), deltas.end(), [](const cellDelta& a, const cellDelta& b) { return a.loc < b.loc; });
+
+	// Deltas arrive in map order, so the iterator from the last insert is usually the right hint for the next
+	map<cellLoc, cellData>::iterator it = cells.begin();
+	for (size_t i = 0; i < deltas.size();)
+	{
+		cellLoc loc = deltas[i].loc;
+		int neighbors = 0, born = 0;
+		for (; i < deltas.size() && deltas[i].loc == loc; i++)
+		{
+			neighbors += deltas[i].neighbors;
+			born |= deltas[i].born;
+		}
+
+		if (it != cells.end() && it->first < loc)
+		{
+			it = cells.lower_bound(loc);
+		}
+		if (it == cells.end() || !(it->first == loc))
+		{
+			it = cells.emplace_hint(it, loc, cellData{ 0, 0, 0 });
+		}
+		it->second.neighbors += neighbors;
+		if (born)
+		{
+			trackChange(loc.x, loc.y, it->second.currState, 1);
+			liveCells += it->second.currState == 0 ? 1 : 0;
+			it->second.currState = it->second.nextState = 1;
+			drawCell(loc.x, loc.y, 1);
+		}
+		it++;
+	}
+}
+
+void applyEdits()
+{
+	// Apply all queued edits at once
+	if (pendingEdits.empty())
+	{
+		return;
+	}
+	if (universe == &mapUniverse)
+	{
+		editCells(pendingEdits);
+	}
+	else
+	{
+		for (map<cellLoc, int>::iterator edit = pendingEdits.begin(); edit != pendingEdits.end(); edit++)
+		{
+			if (inBounds(edit->first.x, edit->first.y))
+			{
+				universe->setCell(edit->first, edit->second);
+				drawCell(edit->first.x, edit->first.y, edit->second);
+			}
+		}
+		resetCycles();
+	}
+	pendingEdits.clear();
+}
+
+int applyRule(const ruleSet& r, int neighborhood)
+{
+	// Next state (0 or 1) under r of a two state cell with this 3x3 neighborhood, the cell itself being bit 4
+	int n = (int)bitset<9>(neighborhood & 0x1EF).count();
+	bool alive = (neighborhood & 16) != 0;
+	if ((alive ? r.surviveList : r.birthList).count(n) == 0)
+	{
+		return 0;
+	}
+	const map<int, string>& letters = alive ? r.surviveLetters : r.birthLetters;
+	map<int, string>::const_iterator limited = letters.find(n);
+	return (limited == letters.end() || limited->second.find(henselLetter(neighborhood)) != string::npos) ? 1 : 0;
+}
+
+int cellState(cellLoc cell)
+{
+	// State of a cell including any edit still waiting to be applied
+	map<cellLoc, int>::iterator edit = pendingEdits.find(cell);
+	if (edit != pendingEdits.end())
+	{
+		return edit->second;
+	}
+	return universe->getCell(cell);
+}
+
+Uint64 axisPower(int axis, int coord)
+{
+	// HASH_BASE[axis]^coord as the product of two table entries, for the top and bottom 16 bits of the coordinate's offset from
+	// INT_MIN. The tables are filled the first time they are needed.
+	vector<Uint64>& powers = axisPowers[axis];
+	if (powers.empty())
+	{
+		powers.resize(2 * 65536);
+		Uint64 step = powMod(HASH_BASE[axis], 65536);
+		powers[0] = powMod(HASH_BASE[axis], INT_MIN);
+		powers[65536] = 1;
+		for (int i = 1; i < 65536; i++)
+		{
+			powers[i] = mulMod(powers[i - 1], step);
+			powers[65536 + i] = mulMod(powers[65536 + i - 1], HASH_BASE[axis]);
+		}
+	}
+	Uint32 offset = (Uint32)coord ^ 0x80000000u;
+	return mulMod(powers[offset >> 16], powers[65536 + (offset & 0xFFFF)]);
+}
+
+bool benchTrial(engine* e, const vector<cellLoc>& start, benchResult& result)
+{
+	// Load start into e and step it, timing each phase. The first call warms up and picks how many runs make up a trial, so that
+	// each takes BENCH_TRIAL_TIME and small patterns are timed over more than a few ticks. Returns false if a run doesn't end in
+	// the same state as the others.
+	Uint64 phases[6] = { 0, 0, 0, 0, 0, 0 };	// load, step, hash, then the map engine's step split by stepGeneration()
+	for (int r = 0; r < max(result.repeats, 1); r++)
+	{
+		Uint64 begin = SDL_GetPerformanceCounter();
+		inverted = false;
+		e->clear();
+		vector<cellLoc> live = start;
+		e->load(live);
+		Uint64 loaded = SDL_GetPerformanceCounter();
+		Uint64 before[3] = { stepPhaseTicks[0], stepPhaseTicks[1], stepPhaseTicks[2] };
+		e->step(BENCH_GENERATIONS);
+		Uint64 stepped = SDL_GetPerformanceCounter();
+		Sint64 population = e->population();
+		Uint64 hash = e->hash();
+		Uint64 hashed = SDL_GetPerformanceCounter();
+
+		if (result.repeats > 0 && (population != result.population || hash != result.hash))
+		{
+			cout << result.pattern << " on " << result.engine << ": trial " << result.rates.size() + 1 << " ended with population " << population << ", not " << result.population << endl;
+			return false;
+		}
+		result.population = population;
+		result.hash = hash;
+		phases[0] += loaded - begin;
+		phases[1] += stepped - loaded;
+		phases[2] += hashed - stepped;
+		for (int i = 0; i < 3; i++)
+		{
+			phases[3 + i] += stepPhaseTicks[i] - before[i];
+		}
+	}
+	if (result.repeats == 0)
+	{
+		result.repeats = (int)min<Uint64>(BENCH_TRIAL_TIME * perfFrequency / 1000 / max<Uint64>(phases[1], 1) + 1, 1000);
+		return true;
+	}
+
+	result.rates.push_back((double)result.repeats * BENCH_GENERATIONS * perfFrequency / max<Uint64>(phases[1], 1));
+	double scale = 1000.0 / perfFrequency / result.repeats / BENCH_TRIALS;
+	result.phases["load"] += phases[0] * scale;
+	result.phases["step"] += phases[1] * scale;
+	result.phases["hash"] += phases[2] * scale;
+	if (e == &mapUniverse)
+	{
+		result.phases["step: evaluate"] += phases[3] * scale;
+		result.phases["step: update"] += phases[4] * scale;
+		result.phases["step: remove"] += phases[5] * scale;
+	}
+	return true;
+}
+
+Uint64 cellKey(int x, int y)
+{
+	// Zobrist key of a cell: a splitmix64 hash of its coordinates, so the unbounded plane needs no key table
+	Uint64 z = ((Uint64)(Uint32)x << 32 | (Uint32)y) + 0x9E3779B97F4A7C15ull;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+void clearUniverse()
+{
+	// Remove every cell
+	cells.clear();
+	cellsToUpdate.clear();
+	cellsToRemove.clear();
+	pendingEdits.clear();
+	tiles.clear();
+	activity.clear();
+	liveCells = 0;
+	rowCounts.clear();
+	columnCounts.clear();
+	occupancyChanges.clear();
+	zobristHash = shapeHash = 0;
+	sumX = sumY = 0;
+	shapeChanges.clear();
+	if (topology != 0)
+	{
+		boundedGrid.clear();
+	}
+	resetCycles();
+}
+
+int compareBenchmark(const string& path, const vector<benchResult>& results)
+{
+	// Check results against a baseline written by an earlier --bench. A different final state is a wrong answer, and a change in
+	// speed counts when the 95% confidence intervals don't overlap and it is more than BENCH_NOISE. Returns the number of regressions.
+	ifstream in(path);
+	if (!in)
+	{
+		cout << "Could not open baseline " << path << endl;
+		return 1;
+	}
+	map<string, string> header, baseline;
+	string line;
+	while (getline(in, line))
+	{
+		if (line.find("\"pattern\"") != string::npos)
+		{
+			baseline[jsonField(line, "pattern") + " on " + jsonField(line, "engine")] = line;
+		}
+		else
+		{
+			// The settings the baseline ran with, one per line
+			const string keys[3] = { "rule", "seed", "generations" };
+			for (int k = 0; k < 3; k++)
+			{
+				if (header[keys[k]].empty())
+				{
+					header[keys[k]] = jsonField(line, keys[k]);
+				}
+			}
+		}
+	}
+	if (header["rule"] != ruleString(rules) || header["seed"] != to_string(RANDOM_SEED) || header["generations"] != to_string(BENCH_GENERATIONS))
+	{
+		cout << "Baseline " << path << " ran " << header["rule"] << " with seed " << header["seed"] << " for " << header["generations"] <<
+			" generations, so it can't be compared with " << ruleString(rules) << " with seed " << RANDOM_SEED << " for " << BENCH_GENERATIONS << endl;
+		return 1;
+	}
+
+	int regressions = 0;
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		string label = results[i].pattern + " on " + results[i].engine;
+		map<string, string>::iterator base = baseline.find(label);
+		if (base == baseline.end())
+		{
+			cout << label << ": not in the baseline" << endl;
+			continue;
+		}
+		double interval, mean = confidence(results[i].rates, interval);
+		double baseMean = stod(jsonField(base->second, "gensPerSecond")), baseInterval = stod(jsonField(base->second, "interval"));
+		double change = (mean - baseMean) / baseMean;
+		cout << label << ": " << mean << " +/- " << interval << " gens/s vs " << baseMean << " +/- " << baseInterval << " (" << (change >= 0 ? "+" : "") << (int)(change * 100) << "%)";
+		if (to_string(results[i].population) != jsonField(base->second, "population") || results[i].hash != stoull(jsonField(base->second, "finalHash"), 0, 16))
+		{
+			cout << " WRONG ANSWER: population " << results[i].population << " vs " << jsonField(base->second, "population") << endl;
+			regressions++;
+		}
+		else if (mean + interval < baseMean - baseInterval && -change > BENCH_NOISE)
+		{
+			cout << " SLOWER" << endl;
+			regressions++;
+		}
+		else if (mean - interval > baseMean + baseInterval && change > BENCH_NOISE)
+		{
+			cout << " faster" << endl;
+		}
+		else
+		{
+			cout << " within noise" << endl;
+		}
+	}
+	cout << "Compared " << results.size() << " results with " << path << ": " << (regressions ? to_string(regressions) + " regressed" : "no regressions") << endl;
+	return regressions;
+}
+
+void compileRule()
+{
+	// Tabulate the rule by 3x3 neighborhood. A stored cell is the actual cell XOR inverted, so with the background on the actual
+	// neighborhood is the stored one with every bit flipped. The background after a generation follows from the actual rule,
+	// and a stored cell is on next generation wherever the actual cell differs from that background.
+	for (int in = 0; in < 2; in++)
+	{
+		int flip = in ? 0x1FF : 0;
+		int out = applyRule(rules, flip);
+		phaseInverts[in] = out != 0;
+		for (int neighborhood = 0; neighborhood < 512; neighborhood++)
+		{
+			phaseTables[in][neighborhood] = (Uint8)(applyRule(rules, neighborhood ^ flip) ^ out);
+		}
+	}
+
+	// The dense engine has no infinite background to invert, so it runs the rule as written. It only runs 3x3 rules, whose
+	// counts go up to 8.
+	denseBirth = denseSurvive = 0;
+	for (set<int>::iterator n = rules.birthList.begin(); n != rules.birthList.end() && *n <= 8; n++)
+	{
+		denseBirth |= 1 << *n;
+	}
+	for (set<int>::iterator n = rules.surviveList.begin(); n != rules.surviveList.end() && *n <= 8; n++)
+	{
+		denseSurvive |= 1 << *n;
+	}
+	for (int neighborhood = 0; neighborhood < 512; neighborhood++)
+	{
+		denseTable[neighborhood] = (Uint8)applyRule(rules, neighborhood);
+	}
+	denseTotalistic = rules.birthLetters.empty() && rules.surviveLetters.empty();
+
+	// Dying states fade from red towards the background
+	colors.resize(2);
+	for (int state = 2; state < rules.states; state++)
+	{
+		unsigned int fade = 255 - 223 * (state - 2) / (rules.states - 2);
+		colors.push_back({ fade, fade / 4, 0 });
+	}
+}
+
+double confidence(const vector<double>& samples, double& interval)
+{
+	// Mean of samples, with the half width of its 95% confidence interval from Student's t distribution
+	const double T95[10] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228 };
+	double mean = 0, variance = 0;
+	for (size_t i = 0; i < samples.size(); i++)
+	{
+		mean += samples[i] / samples.size();
+	}
+	for (size_t i = 0; i < samples.size(); i++)
+	{
+		variance += (samples[i] - mean) * (samples[i] - mean);
+	}
+	int freedom = (int)samples.size() - 1;
+	interval = 0;
+	if (freedom > 0)
+	{
+		double t = freedom <= 10 ? T95[freedom - 1] : 1.96 + 2.4 / freedom;
+		interval = t * sqrt(variance / freedom / samples.size());
+	}
+	return mean;
+}
+
+void createRandom()
+{
+	// Create random cells within visible window
+	resetCycles();
+	createSoup(topLeft, numCols, numRows, SOUP_DENSITY);
+	SDL_UpdateWindowSurface(window);
+}
+
+void createSoup(cellLoc corner, int w, int h, double density)
+{
+	// Toggle a random w x h block of cells, then rebuild the block's cell data in a single pass instead of calling updateCell() per cell
+	if (topology != 0)
+	{
+		// Keep to the part of the block inside the bounded universe
+		int right = min(corner.x + w, boundsCorner.x + boundsW), bottom = min(corner.y + h, boundsCorner.y + boundsH);
+		corner = { max(corner.x, boundsCorner.x), max(corner.y, boundsCorner.y) };
+		w = right - corner.x;
+		h = bottom - corner.y;
+	}
+	if (w <= 0 || h <= 0)
+	{
+		return;
+	}
+
+	int rowWords = (w + 63) / 64;
+	vector<Uint64> soup = soupBits(w, h, density);
+	if (universe != &mapUniverse)
+	{
+		for (int y = 0; y < h; y++)
+		{
+			for (int x = 0; x < w; x++)
+			{
+				if ((soup[(size_t)y * rowWords + x / 64] >> (x % 64)) & 1)
+				{
+					cellLoc loc = { corner.x + x, corner.y + y };
+					int state = universe->getCell(loc) ? 0 : 1;
+					universe->setCell(loc, state);
+					drawCell(loc.x, loc.y, state);
+				}
+			}
+		}
+		return;
+	}
+
+	// Snapshot the states of the block plus a two cell border, column by column (cells is ordered by x, then y)
+	int gw = w + 4, gh = h + 4;
+	int x0 = corner.x - 2, y0 = corner.y - 2;
+	vector<unsigned char> live((size_t)gw * gh, 0);
+	for (int gx = 0; gx < gw; gx++)
+	{
+		for (map<cellLoc, cellData>::iterator it = cells.lower_bound({ x0 + gx, y0 }); it != cells.end() && it->first.x == x0 + gx && it->first.y < y0 + gh; it++)
+		{
+			live[(size_t)gx * gh + (it->first.y - y0)] = it->second.currState;
+		}
+	}
+	for (int y = 0; y < h; y++)
+	{
+		for (int x = 0; x < w; x++)
+		{
+			if ((soup[(size_t)y * rowWords + x / 64] >> (x % 64)) & 1)
+			{
+				unsigned char& state = live[(size_t)(x + 2) * gh + (y + 2)];
+				int oldState = state;
+				state = state ? 0 : 1;
+				trackChange(corner.x + x, corner.y + y, oldState, state);
+				liveCells += state ? 1 : -1;
+				drawCell(corner.x + x, corner.y + y, state);
+			}
+		}
+	}
+
+	// Recount neighbors for the block and the ring around it, and write the results back with hinted inserts
+	for (int gx = 1; gx < gw - 1; gx++)
+	{
+		map<cellLoc, cellData>::iterator it = cells.lower_bound({ x0 + gx, y0 + 1 });
+		for (int gy = 1; gy < gh - 1; gy++)
+		{
+			int state = live[(size_t)gx * gh + gy];
+			int neighbors = 0;
+			for (int dx = -1; dx <= 1; dx++)
+			{
+				const unsigned char* column = &live[(size_t)(gx + dx) * gh + gy];
+				neighbors |= (column[-1] == 1 ? neighborBit(dx, -1) : 0) | (column[0] == 1 && dx != 0 ? neighborBit(dx, 0) : 0) | (column[1] == 1 ? neighborBit(dx, 1) : 0);
+			}
+
+			cellLoc loc = { x0 + gx, y0 + gy };
+			bool exists = it != cells.end() && it->first == loc;
+			if (state == 0 && neighbors == 0)
+			{
+				if (exists)
+				{
+					it = cells.erase(it);
+				}
+			}
+			else if (exists)
+			{
+				it->second = { state, state, neighbors };
+				it++;
+			}
+			else
+			{
+				it = cells.emplace_hint(it, loc, cellData{ state, state, neighbors });
+				it++;
+			}
+		}
+	}
+}
+
+void decodeChanges(const vector<Uint8>& changes, set<cellLoc>& live)
+{
+	// Toggle each cell listed in an encoded change list
+	cellLoc cell = { 0, 0 };
+	for (size_t i = 0; i < changes.size();)
+	{
+		int delta[2];
+		for (int d = 0; d < 2; d++)
+		{
+			Uint32 value = 0;
+			for (int shift = 0; ; shift += 7)
+			{
+				value |= (Uint32)(changes[i] & 0x7F) << shift;
+				if (!(changes[i++] & 0x80))
+				{
+					break;
+				}
+			}
+			delta[d] = (int)(value >> 1) ^ -(int)(value & 1);
+		}
+		cell = { cell.x + delta[0], cell.y + delta[1] };
+		if (!live.insert(cell).second)
+		{
+			live.erase(cell);
+		}
+	}
+}
+
+bool detectCycle()
+{
+	// Look this generation up among the last CYCLE_WINDOW: an exact repeat is an oscillation, and a repeat of the shape alone
+	// is a translation by the change in centroid. Returns true when a new cycle is found. Patterns wrap around a bounded universe
+	// rather than translating, so there only exact repeats count.
+	int population = liveCells;
+	Uint64 stateKey = zobristHash ^ cellKey(population, inverted ? 2 : 0);
+	Uint64 shapeKey = invariantHash() ^ cellKey(population, inverted ? 3 : 1);
+	cellLoc centroid = { 0, 0 };
+	if (population > 0)
+	{
+		centroid = { (int)floorDiv(sumX, population), (int)floorDiv(sumY, population) };
+	}
+
+	cycleInfo found = { 0, 0, 0 };
+	unordered_map<Uint64, recentState>::iterator match = recentStates.find(stateKey);
+	if (match != recentStates.end())
+	{
+		found = { frame - match->second.frame, 0, 0 };
+	}
+	else if (topology == 0 && (match = recentShapes.find(shapeKey)) != recentShapes.end())
+	{
+		found = { frame - match->second.frame, centroid.x - match->second.centroid.x, centroid.y - match->second.centroid.y };
+	}
+
+	recentStates[stateKey] = { frame, centroid };
+	recentShapes[shapeKey] = { frame, centroid };
+	recentOrder.push_back({ stateKey, shapeKey });
+	if ((int)recentOrder.size() > CYCLE_WINDOW)
+	{
+		// Forget the oldest generation unless a later one has taken over its key
+		pair<Uint64, Uint64> oldest = recentOrder.front();
+		recentOrder.pop_front();
+		int oldestFrame = frame - CYCLE_WINDOW;
+		if (recentStates.count(oldest.first) && recentStates[oldest.first].frame <= oldestFrame)
+		{
+			recentStates.erase(oldest.first);
+		}
+		if (recentShapes.count(oldest.second) && recentShapes[oldest.second].frame <= oldestFrame)
+		{
+			recentShapes.erase(oldest.second);
+		}
+	}
+
+	if (found.period > 0 && cycle.period == 0)
+	{
+		cycle = found;
+		return true;
+	}
+	return false;
+}
+
+void drawCell(int x, int y, int state)
+{
+	fillCell(x, y, colors[state ^ inverted]);
+}
+
+void drawPosterBand(cellLoc low, cellLoc high, int scale, bool bgr, vector<Uint8>& pixels)
+{
+	// Rasterize the cells from low up to (not including) high into 24-bit rows padded to 4 bytes, scale pixels to a cell side,
+	// coloured as drawCell() would
+	size_t width = (size_t)(high.x - low.x) * scale, rows = (size_t)(high.y - low.y) * scale, pitch = (width * 3 + 3) & ~(size_t)3;
+	pixels.assign(pitch * rows, 0);
+	auto fill = [&](size_t x, size_t y, color c)
+	{
+		for (size_t row = y; row < y + scale; row++)
+		{
+			Uint8* p = &pixels[row * pitch + x * 3];
+			for (int i = 0; i < scale; i++, p += 3)
+			{
+				p[0] = (Uint8)(bgr ? c.b : c.r);
+				p[1] = (Uint8)c.g;
+				p[2] = (Uint8)(bgr ? c.r : c.b);
+			}
+		}
+	};
+
+	// Background (state 0) down the first column of cells, copied across each row
+	if (colors[inverted].r != 0 || colors[inverted].g != 0 || colors[inverted].b != 0)
+	{
+		for (size_t y = 0; y < rows; y += scale)
+		{
+			fill(0, y, colors[inverted]);
+		}
+		for (size_t row = 0; row < rows; row++)
+		{
+			for (size_t x = 3; x < width * 3; x++)
+			{
+				pixels[row * pitch + x] = pixels[row * pitch + x - 3];
+			}
+		}
+	}
+
+	vector<pair<cellLoc, int>> visible;
+	universe->viewport(low, high, visible);
+	for (size_t i = 0; i < visible.size(); i++)
+	{
+		fill((size_t)(visible[i].first.x - low.x) * scale, (size_t)(visible[i].first.y - low.y) * scale, colors[visible[i].second ^ inverted]);
+	}
+}
+
+void editCells(map<cellLoc, int>& edits)
+{
+	// Apply a batch of edits to the map engine with one neighborhood reconciliation, rather than an updateCell() and removeCells() per edit
+
+	// Set the new states and total up each affected cell's change in neighborhood
+	map<cellLoc, int> neighborChanges;
+	vector<cellLoc> changed;
+	for (map<cellLoc, int>::iterator edit = edits.begin(); edit != edits.end(); edit++)
+	{
+		int x0 = edit->first.x, y0 = edit->first.y;
+		map<cellLoc, cellData>::iterator it = cells.find(edit->first);
+		if ((it == cells.end() ? 0 : it->second.currState) == edit->second || !inBounds(x0, y0))
+		{
+			continue;
+		}
+		if (it == cells.end())
+		{
+			it = cells.insert({ edit->first, { 0, 0, 0 } }).first;
+		}
+		int oldState = it->second.currState;
+		it->second.currState = it->second.nextState = edit->second;
+		trackChange(x0, y0, oldState, edit->second);
+		liveCells += (edit->second != 0) - (oldState != 0);
+		drawCell(x0, y0, edit->second);
+		changed.push_back(edit->first);
+
+		// Only state 1 counts as a neighbor
+		int countChange = (edit->second == 1) - (oldState == 1);
+		if (countChange == 0)
+		{
+			continue;
+		}
+
+		for (int y = y0 - 1; y < y0 + 2; y++)
+		{
+			for (int x = x0 - 1; x < x0 + 2; x++)
+			{
+				if (x != x0 || y != y0)
+				{
+					neighborChanges[{x, y}] += countChange * neighborBit(x0 - x, y0 - y);
+				}
+			}
+		}
+	}
+	if (!changed.empty())
+	{
+		resetCycles();
+	}
+
+	// Merge the neighborhood changes into cells in order, dropping dead cells left with no neighbors
+	for (map<cellLoc, int>::iterator change = neighborChanges.begin(); change != neighborChanges.end(); change++)
+	{
+		map<cellLoc, cellData>::iterator it = cells.lower_bound(change->first);
+		if (it == cells.end() || !(it->first == change->first))
+		{
+			it = cells.emplace_hint(it, change->first, cellData{ 0, 0, 0 });
+		}
+		it->second.neighbors += change->second;
+		if (it->second.currState == 0 && it->second.neighbors == 0)
+		{
+			cells.erase(it);
+		}
+	}
+	for (size_t i = 0; i < changed.size(); i++)
+	{
+		map<cellLoc, cellData>::iterator cell = cells.find(changed[i]);
+		if (cell != cells.end() && cell->second.currState == 0 && cell->second.neighbors == 0)
+		{
+			cells.erase(cell);
+		}
+	}
+}
+
+vector<Uint8> encodeChanges(vector<cellLoc>& changed)
+{
+	// Sort the toggled cells into map order and store each as zigzag varint offsets from the one before,
+	// which packs a typical generation's changes into two or three bytes per cell
+	sort(changed.begin(), changed.end());
+	vector<Uint8> changes;
+	cellLoc previous = { 0, 0 };
+	for (size_t i = 0; i < changed.size(); i++)
+	{
+		int delta[2] = { changed[i].x - previous.x, changed[i].y - previous.y };
+		for (int d = 0; d < 2; d++)
+		{
+			Uint32 value = ((Uint32)delta[d] << 1) ^ (Uint32)(delta[d] >> 31);
+			while (value >= 0x80)
+			{
+				changes.push_back((Uint8)(value | 0x80));
+				value >>= 7;
+			}
+			changes.push_back((Uint8)value);
+		}
+		previous = changed[i];
+	}
+	return changes;
+}
+
+double engineWork(int index, Sint64 population, Sint64 changes, cellLoc low, cellLoc high)
+{
+	// Work per generation for an engine, in the units of engineUnitCost. The map engine's cost follows the cells that change (and
+	// in a bounded universe, the bit array it steps); the dense engine's follows the size of its box.
+	double area = topology != 0 ? (double)boundsW * boundsH : 1.5 * (high.x - low.x + 66) * (high.y - low.y + 3);
+	if (ENGINES[index] == &denseUniverse)
+	{
+		return denseUniverse.width > 0 && universe == &denseUniverse ? (double)denseUniverse.width * denseUniverse.height : area;
+	}
+	return changes + population / 16.0 + (topology != 0 ? area * ADAPT_DENSE_COST / ADAPT_MAP_COST : 0);
+}
+
+void exportPattern(const string& path, bool macrocell)
+{
+	// Copy the live cells at this generation boundary and write them on a background thread while the simulation carries on
+	if (inverted)
+	{
+		cout << "The background is on, so the universe has no finite pattern to export" << endl;
+		return;
+	}
+	if (rules.states > 2)
+	{
+		cout << "Export only writes two state patterns" << endl;
+		return;
+	}
+	vector<pair<cellLoc, int>> found;
+	universe->viewport({ INT_MIN, INT_MIN }, { INT_MAX, INT_MAX }, found);
+	vector<cellLoc> live;
+	live.reserve(found.size());
+	for (size_t i = 0; i < found.size(); i++)
+	{
+		live.push_back(found[i].first);
+	}
+
+	// Only one export runs at a time
+	if (exportThread.joinable())
+	{
+		exportThread.join();
+	}
+	exportThread = thread(macrocell ? writeMacrocell : writeRLE, path, move(live), ruleString(rules), frame);
+}
+
+void endTileGeneration()
+{
+	// Age each tile's change history by a generation and decide which tiles the next one evaluates. A tile sleeps when its own
+	// changes and those on the facing rims of its neighbors were the same for the last two generations: the tile and the ring
+	// around it are then back in the state of two generations ago, so they will repeat the last toggles. Sleeping tiles with
+	// nothing to repeat are forgotten, as a toggle on a neighbor's rim brings them back.
+	static const int dx[8] = { -1, 1, 0, 0, -1, 1, -1, 1 };
+	static const int dy[8] = { 0, 0, -1, 1, -1, -1, 1, 1 };
+	for (map<cellLoc, tileActivity>::iterator it = activity.begin(); it != activity.end(); it++)
+	{
+		tileActivity& tile = it->second;
+		tile.changes[2] = tile.changes[1];
+		tile.changes[1] = tile.changes[0];
+		tile.changes[0] = 0;
+		for (int r = 0; r < 8; r++)
+		{
+			tile.rim[2][r] = tile.rim[1][r];
+			tile.rim[1][r] = tile.rim[0][r];
+			tile.rim[0][r] = 0;
+		}
+		tile.toggled[1].swap(tile.toggled[0]);
+		tile.toggled[0].clear();
+		if (tile.wake > 0)
+		{
+			tile.wake--;
+		}
+		tile.awake = tile.wake > 0 || tile.changes[1] != tile.changes[2];
+	}
+
+	// A tile that is dropped here and woken by a later one comes back with an empty history, which keeps it awake
+	for (map<cellLoc, tileActivity>::iterator it = activity.begin(); it != activity.end();)
+	{
+		for (int r = 0; r < 8; r++)
+		{
+			if (it->second.rim[1][r] != it->second.rim[2][r])
+			{
+				activity[{ it->first.x + dx[r], it->first.y + dy[r] }].awake = true;
+			}
+		}
+		it = (!it->second.awake && it->second.toggled[1].empty()) ? activity.erase(it) : ++it;
+	}
+}
+
+void expandMacrocell(const vector<mcNode>& nodes, int node, int x, int y, vector<cellLoc>& batch)
+{
+	// Emit the live cells of a Macrocell node with its top left corner at (x, y), handing them to the engine a batch at a time
+	if (node == 0)
+	{
+		return;
+	}
+	const mcNode& n = nodes[node];
+	if (n.level == 3)
+	{
+		for (int i = 0; i < 64; i++)
+		{
+			if ((n.bits >> i) & 1)
+			{
+				batch.push_back({ x + i % 8, y + i / 8 });
+			}
+		}
+	}
+	else if (n.level == 1)
+	{
+		// Multi-state files describe 2x2 nodes with cell states in place of children
+		for (int i = 0; i < 4; i++)
+		{
+			if (n.child[i] != 0)
+			{
+				batch.push_back({ x + i % 2, y + i / 2 });
+			}
+		}
+	}
+	else
+	{
+		int half = 1 << (n.level - 1);
+		for (int i = 0; i < 4; i++)
+		{
+			expandMacrocell(nodes, n.child[i], x + (i % 2) * half, y + (i / 2) * half, batch);
+		}
+	}
+	if (batch.size() >= LOAD_BATCH)
+	{
+		universe->load(batch);
+		batch.clear();
+	}
+}
+
+void fastForward(int generations)
+{
+	// Skip whole periods of the detected cycle without stepping them: an oscillator is left as it is, and a spaceship universe
+	// is moved by the displacement (with the view following it)
+	if (cycle.period == 0)
+	{
+		cout << "No cycle detected to fast forward" << endl;
+		return;
+	}
+	cycleInfo current = cycle;
+	int periods = generations / current.period;
+	if ((current.dx != 0 || current.dy != 0) && rules.states > 2)
+	{
+		// Rebuilding the moved universe only restores state 1 cells
+		cout << "Can only fast forward moving two state patterns" << endl;
+		return;
+	}
+	if (current.dx != 0 || current.dy != 0)
+	{
+		vector<cellLoc> live;
+		live.reserve(liveCells);
+		for (map<cellLoc, cellData>::iterator it = cells.begin(); it != cells.end(); it++)
+		{
+			if (it->second.currState == 1)
+			{
+				live.push_back({ it->first.x + periods * current.dx, it->first.y + periods * current.dy });
+			}
+		}
+		replaying = true;
+		clearUniverse();
+		addCells(live);
+		replaying = false;
+		center = { center.x + periods * current.dx, center.y + periods * current.dy };
+	}
+	frame += periods * current.period;
+	resetHistory();
+	resetCycles();
+	cycle = current;
+	cout << "Fast forwarded " << periods * current.period << " generations to " << frame << endl;
+}
+
+void fillCell(int x, int y, color c)
+{
+	// No need to draw if cell does not appear in the window
+	if (x >= topLeft.x && x < (topLeft.x + numCols) && y >= topLeft.y && y < (topLeft.y + numRows))
+	{
+		// Calculate screen offsets
+		int screen_x = (x - topLeft.x); // *(CELL_SIZE + 1);
+		int screen_y = (y - topLeft.y); // *(CELL_SIZE + 1);
+
+		// Draw the cell
+		Uint8* pixel_ptr = (Uint8*)surface->pixels + (screen_y * (CELL_SIZE + 1) * WIDTH + screen_x * (CELL_SIZE + 1)) * 4;
+
+		for (unsigned int i = 0; i < CELL_SIZE; i++)
+		{
+			for (unsigned int j = 0; j < CELL_SIZE; j++)
+			{
+				*(pixel_ptr + j * 4) = c.r;
+				*(pixel_ptr + j * 4 + 1) = c.g;
+				*(pixel_ptr + j * 4 + 2) = c.b;
+			}
+			pixel_ptr += WIDTH * 4;
+		}
+	}
+}
+
+engine* findEngine(const string& name)
+{
+	// Engine with the given name, or NULL
+	for (int i = 0; i < (int)(sizeof(ENGINES) / sizeof(ENGINES[0])); i++)
+	{
+		if (ENGINES[i]->name() == name)
+		{
+			return ENGINES[i];
+		}
+	}
+	return NULL;
+}
+
+void finishReplay()
+{
+	// End the replay with how long it took, for comparing against the session it recorded
+	sessionReplay = false;
+	double seconds = (double)(SDL_GetPerformanceCounter() - sessionStart) / perfFrequency;
+	cout << "Replayed " << sessionEvents << " events and " << sessionSteps << " generations in " << seconds * 1000 << " ms (" <<
+		(sessionSteps ? seconds * 1000 / sessionSteps : 0) << " ms per generation), ending at generation " << frame << " with " << universe->population() << " live cells" << endl;
+}
+
+void finishVideo()
+{
+	// Let the writer drain the queue, then report how much it held up the simulation
+	{
+		lock_guard<mutex> lock(videoLock);
+		videoDone = true;
+	}
+	videoReady.notify_all();
+	videoThread.join();
+	videoOut.close();
+	for (size_t i = 0; i < videoSpare.size(); i++)
+	{
+		SDL_FreeSurface(videoSpare[i]);
+	}
+	videoSpare.clear();
+	cout << "Wrote " << videoWritten << " frames to " << videoPath << "; the simulation waited " << videoWaitTicks * 1000 / perfFrequency <<
+		" ms for the writer" << endl;
+}
+
+void fitView()
+{
+	// Center the view on the bounding box at the largest cell size that shows all of it (or the smallest, if none does)
+	cellLoc low, high;
+	if (!universe->bounds(low, high))
+	{
+		return;
+	}
+	Sint64 w = (Sint64)high.x - low.x + 1, h = (Sint64)high.y - low.y + 1;
+	center = { (int)(low.x + w / 2), (int)(low.y + h / 2) };
+	CELL_SIZE = (unsigned int)max(min(WIDTH / w, HEIGHT / h), (Sint64)2) - 1;
+	moveScreen(center);
+}
+
+Sint64 floorDiv(Sint64 a, Sint64 b)
+{
+	// a / b rounded down rather than toward zero (b > 0)
+	return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+void handleEvent(SDL_Event& event, bool& running, bool& paused, bool& singleFrame, double fps)
+{
+	// Act on one keyboard, mouse or window event
+	switch (event.type)
+	{
+	case SDL_QUIT:
+		running = false;
+		break;
+	case SDL_KEYDOWN:
+		switch (event.key.keysym.sym)
+		{
+		case SDLK_ESCAPE:
+			running = false;
+			break;
+		case SDLK_SPACE:
+			paused = !paused;
+			break;
+			// Arrow keys move display over 10%
+		case SDLK_LEFT:
+			center = { center.x - (numCols / 10), center.y };
+			moveScreen(center);
+			break;
+		case SDLK_RIGHT:
+			center = { center.x + (numCols / 10), center.y };
+			moveScreen(center);
+			break;
+		case SDLK_UP:
+			center = { center.x, center.y - (numCols / 10) };
+			moveScreen(center);
+			break;
+		case SDLK_DOWN:
+			center = { center.x, center.y + (numCols / 10) };
+			moveScreen(center);
+			break;
+			// PgUp/PgDn change block size
+		case SDLK_PAGEUP:
+			CELL_SIZE++;
+			moveScreen(center);
+			break;
+		case SDLK_PAGEDOWN:
+			if (CELL_SIZE > 1)
+			{
+				CELL_SIZE--;
+				moveScreen(center);
+			}
+			break;
+			// Home fits the view to the pattern
+		case SDLK_HOME:
+			fitView();
+			showStats(fps);
+			break;
+			// +/- Change frame rate
+		case SDLK_KP_PLUS:
+			FRAME_DELAY /= 1.2;
+			break;
+		case SDLK_KP_MINUS:
+			FRAME_DELAY *= 1.2;
+			break;
+			// W/M write the universe as RLE/Macrocell
+		case SDLK_w:
+			applyEdits();
+			exportPattern("gen" + to_string(frame) + ".rle", false);
+			break;
+		case SDLK_m:
+			applyEdits();
+			exportPattern("gen" + to_string(frame) + ".mc", true);
+			break;
+			// P renders the whole universe as a BMP
+		case SDLK_p:
+			applyEdits();
+			writePoster("gen" + to_string(frame) + ".bmp", POSTER_SCALE);
+			break;
+			// F5 saves a checkpoint, F9 restores it
+		case SDLK_F5:
+			applyEdits();
+			saveCheckpoint(CHECKPOINT_FILE);
+			break;
+		case SDLK_F9:
+			pendingEdits.clear();
+			if (loadPattern(CHECKPOINT_FILE))
+			{
+				moveScreen(center);
+			}
+			break;
+			// Backspace steps back one generation, or HISTORY_KEYFRAME with shift
+		case SDLK_BACKSPACE:
+			pendingEdits.clear();
+			if (seekHistory(frame - ((event.key.keysym.mod & KMOD_SHIFT) ? HISTORY_KEYFRAME : 1)))
+			{
+				paused = true;
+				moveScreen(center);
+				showStats(fps);
+			}
+			break;
+			// Jump ahead through a detected cycle
+		case SDLK_f:
+			applyEdits();
+			fastForward(FAST_FORWARD);
+			moveScreen(center);
+			showStats(fps);
+			break;
+		case SDLK_r:
+			applyEdits();
+			createRandom();
+			break;
+			// E moves the universe onto the next engine, taking over from the adaptive controller
+		case SDLK_e:
+			applyEdits();
+			adaptive = false;
+			for (int e = 0; e < (int)(sizeof(ENGINES) / sizeof(ENGINES[0])); e++)
+			{
+				if (ENGINES[e] == universe)
+				{
+					switchEngine(ENGINES[(e + 1) % (sizeof(ENGINES) / sizeof(ENGINES[0]))]);
+					break;
+				}
+			}
+			moveScreen(center);
+			showStats(fps);
+			break;
+			// [/] change brush size
+		case SDLK_LEFTBRACKET:
+			if (BRUSH_SIZE > 1)
+			{
+				BRUSH_SIZE--;
+			}
+			break;
+		case SDLK_RIGHTBRACKET:
+			BRUSH_SIZE++;
+			break;
+			// Advance a single frame
+		case SDLK_s:
+			paused = false;
+			singleFrame = true;
+			break;
+		}
+		break;
+	case SDL_DROPFILE:
+		// Load a pattern file dropped on the window into the universe
+		if (loadPattern(event.drop.file))
+		{
+			moveScreen(center);
+		}
+		SDL_free(event.drop.file);
+		break;
+	case SDL_MOUSEBUTTONDOWN:
+		if (event.button.button == SDL_BUTTON_LEFT)
+		{
+			toggleCell({ event.button.x, event.button.y });
+		}
+		break;
+	case SDL_MOUSEMOTION:
+		// Dragging with the left button held continues the stroke
+		if (event.motion.state & SDL_BUTTON_LMASK)
+		{
+			paintStroke({ event.motion.x, event.motion.y });
+		}
+		break;
+	}
+}
+
+char henselLetter(int neighborhood)
+{
+	// Hensel letter of the eight cells around the center (0 for counts 0 and 8), found by matching each rotation and reflection
+	// against the representatives. Counts above 4 take the letter of their complement.
+	int outer = neighborhood & 0x1EF;
+	int n = (int)bitset<9>(outer).count();
+	if (n > 4)
+	{
+		outer ^= 0x1EF;
+		n = 8 - n;
+	}
+	for (int symmetry = 0; symmetry < 8; symmetry++)
+	{
+		int moved = 0;
+		for (int bit = 0; bit < 9; bit++)
+		{
+			if ((outer >> bit) & 1)
+			{
+				int dx = bit % 3 - 1, dy = bit / 3 - 1;
+				for (int turn = 0; turn < symmetry % 4; turn++)
+				{
+					int t = dx;
+					dx = -dy;
+					dy = t;
+				}
+				moved |= neighborBit(symmetry >= 4 ? -dx : dx, dy);
+			}
+		}
+		for (size_t i = 0; i < HENSEL_LETTERS[n].size(); i++)
+		{
+			if (HENSEL_NEIGHBORHOODS[n][i] == moved)
+			{
+				return HENSEL_LETTERS[n][i];
+			}
+		}
+	}
+	return 0;
+}
+
+bool inBounds(int x, int y)
+{
+	// Whether a cell is part of the universe: always, unless it is bounded
+	return topology == 0 || (x >= boundsCorner.x && x < boundsCorner.x + boundsW && y >= boundsCorner.y && y < boundsCorner.y + boundsH);
+}
+
+Uint64 invariantHash()
+{
+	// shapeHash with the pattern moved so its (rounded down) centroid is at the origin, which every translated copy shares
+	syncShape();
+	if (liveCells == 0)
+	{
+		return 0;
+	}
+	Sint64 cx = floorDiv(sumX, liveCells), cy = floorDiv(sumY, liveCells);
+	return mulMod(shapeHash, mulMod(powMod(HASH_BASE[0], -cx), powMod(HASH_BASE[1], -cy)));
+}
+
+string jsonField(const string& line, const string& key)
+{
+	// Value of "key" in a line of --bench JSON, unquoted if it is a string; empty if absent
+	size_t at = line.find(jsonQuote(key) + ": ");
+	if (at == string::npos)
+	{
+		return "";
+	}
+	at += key.size() + 4;
+	string value;
+	if (at < line.size() && line[at] == '"')
+	{
+		for (at++; at < line.size() && line[at] != '"'; at++)
+		{
+			if (line[at] == '\\' && at + 1 < line.size())
+			{
+				at++;
+			}
+			value += line[at];
+		}
+		return value;
+	}
+	while (at < line.size() && line[at] != ',' && line[at] != '}' && line[at] != ']')
+	{
+		value += line[at++];
+	}
+	return value;
+}
+
+string jsonQuote(const string& text)
+{
+	// text as a JSON string; pattern paths may hold backslashes
+	string quoted = "\"";
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		if (text[i] == '"' || text[i] == '\\')
+		{
+			quoted += '\\';
+		}
+		quoted += text[i];
+	}
+	return quoted + "\"";
+}
+
+bool loadCheckpoint(const char* p, size_t size)
+{
+	// Replace the universe, rule, generation and view with a checkpoint's. The mapped tiles are read in place.
+	const checkpointHeader* header = (const checkpointHeader*)p;
+	if (p[sizeof(CHECKPOINT_MAGIC) - 1] != CHECKPOINT_MAGIC[sizeof(CHECKPOINT_MAGIC) - 1])
+	{
+		cout << "Checkpoint is from another version of the format" << endl;
+		return false;
+	}
+	if (size < sizeof(checkpointHeader) || (size - sizeof(checkpointHeader)) / sizeof(checkpointTile) < header->tileCount)
+	{
+		cout << "Truncated checkpoint" << endl;
+		return false;
+	}
+	if ((int)header->topology != topology || (topology != 0 && (header->boundsW != boundsW || header->boundsH != boundsH)))
+	{
+		// The cells would evolve differently in another universe
+		const string kinds[4] = { "the unbounded plane", "a torus", "a Klein bottle", "a bounded plane" };
+		cout << "Checkpoint is of " << kinds[header->topology < 4 ? header->topology : 0];
+		if (header->topology != 0)
+		{
+			cout << " " << header->boundsW << "x" << header->boundsH;
+		}
+		cout << "; restore it in a universe of the same kind and size" << endl;
+		return false;
+	}
+	const checkpointTile* tiles = (const checkpointTile*)(p + sizeof(checkpointHeader));
+	if ((header->flags & CHECKPOINT_INVERTED) && (topology != 0 || universe != &mapUniverse))
+	{
+		cout << "Checkpoint has the background on, which only the map engine on the unbounded plane can hold" << endl;
+		return false;
+	}
+
+	ruleSet parsed;
+	for (int n = 0; n <= 8; n++)
+	{
+		if ((header->birth >> n) & 1)
+		{
+			parsed.birthList.insert(n);
+		}
+		if ((header->survive >> n) & 1)
+		{
+			parsed.surviveList.insert(n);
+		}
+	}
+	const char* ruleText = (const char*)(tiles + header->tileCount);
+	if (!setRule((header->flags & CHECKPOINT_RULE_TEXT) ? string(ruleText, p + size) : ruleString(parsed)))
+	{
+		// The cells would run under the wrong rule
+		cout << "Checkpoint not restored" << endl;
+		return false;
+	}
+
+	universe->clear();
+	inverted = (header->flags & CHECKPOINT_INVERTED) != 0;
+	frame = (int)header->frame;
+	center = { header->centerX, header->centerY };
+	CELL_SIZE = header->cellSize > 0 ? header->cellSize : CELL_SIZE;
+
+	// Neighborhoods are rebuilt by the bulk insert
+	vector<cellLoc> batch;
+	for (Uint64 t = 0; t < header->tileCount; t++)
+	{
+		for (int i = 0; i < 64; i++)
+		{
+			if ((tiles[t].bits >> i) & 1)
+			{
+				batch.push_back({ tiles[t].x * 8 + i % 8, tiles[t].y * 8 + i / 8 });
+			}
+		}
+		if (batch.size() >= LOAD_BATCH)
+		{
+			universe->load(batch);
+			batch.clear();
+		}
+	}
+	universe->load(batch);
+	return true;
+}
+
+bool loadMacrocell(const char* p, const char* end)
+{
+	// Macrocell: a header line, # comments (#R rule, #G generation), then one quadtree node per line, root last
+	vector<mcNode> nodes(1, mcNode{ 0, 0, { 0, 0, 0, 0 } });	// Node 0 is the empty node
+	while (p < end)
+	{
+		const char* lineEnd = find(p, end, '\n');
+		string line(p, lineEnd);
+		p = (lineEnd < end) ? lineEnd + 1 : end;
+		if (!line.empty() && line.back() == '\r')
+		{
+			line.pop_back();
+		}
+
+		if (line.empty() || line[0] == '[')
+		{
+			continue;
+		}
+		if (line[0] == '#')
+		{
+			if (line.compare(0, 3, "#R ") == 0)
+			{
+				setRule(line.substr(3));
+			}
+			else if (line.compare(0, 3, "#G ") == 0)
+			{
+				frame = atoi(line.c_str() + 3);
+			}
+			continue;
+		}
+
+		mcNode n = { 3, 0, { 0, 0, 0, 0 } };
+		if (line[0] == '.' || line[0] == '*' || line[0] == '$')
+		{
+			// 8x8 leaf: rows of . and * ended by $
+			int x = 0, y = 0;
+			for (size_t i = 0; i < line.size() && y < 8; i++)
+			{
+				if (line[i] == '$')
+				{
+					x = 0;
+					y++;
+				}
+				else
+				{
+					if (line[i] == '*' && x < 8)
+					{
+						n.bits |= 1ull << (y * 8 + x);
+					}
+					x++;
+				}
+			}
+		}
+		else
+		{
+			istringstream fields(line);
+			if (!(fields >> n.level >> n.child[0] >> n.child[1] >> n.child[2] >> n.child[3]) || n.level < 1 || n.level > 30)
+			{
+				cout << "Bad Macrocell node: " << line << endl;
+				return false;
+			}
+			for (int i = 0; n.level > 1 && i < 4; i++)
+			{
+				if (n.child[i] < 0 || n.child[i] >= (int)nodes.size())
+				{
+					cout << "Bad Macrocell node: " << line << endl;
+					return false;
+				}
+			}
+		}
+		nodes.push_back(n);
+	}
+	if (nodes.size() < 2)
+	{
+		return false;
+	}
+
+	// The root is centered on the origin
+	int root = (int)nodes.size() - 1;
+	int half = 1 << (nodes[root].level - 1);
+	vector<cellLoc> batch;
+	expandMacrocell(nodes, root, -half, -half, batch);
+	universe->load(batch);
+	return true;
+}
+
+bool loadPattern(const string& path)
+{
+	// Load an RLE, Macrocell or checkpoint file into the universe, chosen by its header
+	mappedFile file;
+	if (!file.open(path))
+	{
+		cout << "Could not open " << path << endl;
+		return false;
+	}
+	const char* p = file.data;
+	const char* end = file.data + file.size;
+	bool loaded;
+	if (file.size >= sizeof(CHECKPOINT_MAGIC) && equal(CHECKPOINT_MAGIC, CHECKPOINT_MAGIC + sizeof(CHECKPOINT_MAGIC) - 1, p))
+	{
+		loaded = loadCheckpoint(p, file.size);
+	}
+	else if (inverted)
+	{
+		cout << "The background is on, so " << path << " cannot be added to the universe" << endl;
+		return false;
+	}
+	else if (file.size >= 4 && string(p, 4) == "[M2]")
+	{
+		loaded = loadMacrocell(p, end);
+	}
+	else
+	{
+		loaded = loadRLE(p, end);
+	}
+	if (loaded)
+	{
+		resetHistory();
+		resetCycles();
+		cout << "Loaded " << path << ": " << universe->population() << " live cells" << endl;
+	}
+	return loaded;
+}
+
+bool loadRLE(const char* p, const char* end)
+{
+	// RLE: # comment lines, a header "x = m, y = n, rule = ...", then runs of b (dead) and o (alive) with $ ending rows and ! ending the pattern
+	int x0 = 0, y0 = 0;
+	bool header = false, positioned = false;
+	while (p < end && !header)
+	{
+		const char* lineEnd = find(p, end, '\n');
+		string line(p, lineEnd);
+		p = (lineEnd < end) ? lineEnd + 1 : end;
+		if (line.empty() || line[0] == '#')
+		{
+			// Golly writes the pattern's position and generation as "#CXRLE Pos=x,y Gen=n"
+			size_t pos = line.find("Pos=");
+			if (line.compare(0, 6, "#CXRLE") == 0 && pos != string::npos)
+			{
+				x0 = atoi(line.c_str() + pos + 4);
+				y0 = atoi(line.c_str() + line.find(',', pos) + 1);
+				positioned = true;
+			}
+			pos = line.find("Gen=");
+			if (line.compare(0, 6, "#CXRLE") == 0 && pos != string::npos)
+			{
+				frame = atoi(line.c_str() + pos + 4);
+			}
+			continue;
+		}
+
+		// Header: without a Pos, center the pattern on the origin
+		int width = 0, height = 0;
+		line.erase(remove_if(line.begin(), line.end(), ::isspace), line.end());
+		size_t xPos = line.find("x="), yPos = line.find("y="), rulePos = line.find("rule=");
+		if (xPos == string::npos || yPos == string::npos)
+		{
+			cout << "Missing RLE header" << endl;
+			return false;
+		}
+		width = atoi(line.c_str() + xPos + 2);
+		height = atoi(line.c_str() + yPos + 2);
+		if (!positioned)
+		{
+			x0 = -width / 2;
+			y0 = -height / 2;
+		}
+		if (rulePos != string::npos)
+		{
+			setRule(line.substr(rulePos + 5));
+		}
+		header = true;
+	}
+
+	// Stream the runs straight into engine load() batches
+	vector<cellLoc> batch;
+	int x = x0, y = y0, count = 0;
+	for (; p < end && *p != '!'; p++)
+	{
+		char c = *p;
+		if (c >= '0' && c <= '9')
+		{
+			count = count * 10 + (c - '0');
+			continue;
+		}
+		int run = count ? count : 1;
+		count = 0;
+		if (c == 'b' || c == '.')
+		{
+			x += run;
+		}
+		else if (c == '$')
+		{
+			x = x0;
+			y += run;
+		}
+		else if (c == 'o' || (c >= 'A' && c <= 'X') || (c >= 'p' && c <= 'y'))
+		{
+			// Multi-state files prefix states above 24 with p..y; all non-zero states load as alive
+			if (c >= 'p' && c <= 'y' && p + 1 < end)
+			{
+				p++;
+			}
+			for (int i = 0; i < run; i++)
+			{
+				batch.push_back({ x++, y });
+			}
+			if (batch.size() >= LOAD_BATCH)
+			{
+				universe->load(batch);
+				batch.clear();
+			}
+		}
+	}
+	universe->load(batch);
+	return true;
+}
+
+void moveScreen(cellLoc centerPoint)
+{
+	numRows = HEIGHT / (CELL_SIZE + 1);
+	numCols = WIDTH / (CELL_SIZE + 1);
+	topLeft = { (centerPoint.x - (numCols / 2)), (centerPoint.y - (numRows / 2)) };
+	// Clear the screen
+	SDL_memset(surface->pixels, 0, surface->h * surface->pitch);
+	if (topology != 0)
+	{
+		// Shade the area outside a bounded universe
+		for (int y = topLeft.y; y < topLeft.y + numRows; y++)
+		{
+			for (int x = topLeft.x; x < topLeft.x + numCols; x++)
+			{
+				if (!inBounds(x, y))
+				{
+					fillCell(x, y, EDGE_COLOR);
+				}
+			}
+		}
+	}
+	if (inverted)
+	{
+		// The background is on
+		for (int y = topLeft.y; y < topLeft.y + numRows; y++)
+		{
+			for (int x = topLeft.x; x < topLeft.x + numCols; x++)
+			{
+				drawCell(x, y, 0);
+			}
+		}
+	}
+
+	// Redraw active cells
+	vector<pair<cellLoc, int>> visible;
+	universe->viewport(topLeft, { topLeft.x + numCols, topLeft.y + numRows }, visible);
+	for (size_t i = 0; i < visible.size(); i++)
+	{
+		drawCell(visible[i].first.x, visible[i].first.y, visible[i].second);
+	}
+	SDL_UpdateWindowSurface(window);
+}
+
+int msUntil(Uint64 deadline)
+{
+	// Whole milliseconds left before the performance counter reaches deadline (0 if already passed)
+	Uint64 now = SDL_GetPerformanceCounter();
+	if (now >= deadline)
+	{
+		return 0;
+	}
+	return (int)((deadline - now) * 1000 / perfFrequency);
+}
+
+Uint64 mulMod(Uint64 a, Uint64 b)
+{
+	// a * b mod 2^61 - 1 for a, b below the modulus, using 32 bit halves (there is no portable 128 bit multiply)
+	Uint64 a1 = a >> 32, a0 = a & 0xFFFFFFFF, b1 = b >> 32, b0 = b & 0xFFFFFFFF;
+	Uint64 middle = a1 * b0 + a0 * b1;
+	Uint64 low = a0 * b0;
+	Uint64 sum = (a1 * b1 << 3) + (middle >> 29) + ((middle & ((1ull << 29) - 1)) << 32) + (low & HASH_PRIME) + (low >> 61);
+	sum = (sum & HASH_PRIME) + (sum >> 61);
+	return sum >= HASH_PRIME ? sum - HASH_PRIME : sum;
+}
+
+int neighborBit(int dx, int dy)
+{
+	// Bit of cellData::neighbors for a live neighbor at offset (dx, dy)
+	return 1 << ((dy + 1) * 3 + dx + 1);
+}
+
+bool optionNumber(const string& option, const string& text, Sint64 low, Sint64 high, Sint64& value)
+{
+	// Read the number given to a command line option, explaining what it takes if it isn't one
+	if (!parseInteger(text, low, high, value))
+	{
+		cout << "Usage: " << option << " takes a whole number from " << low << " to " << high << ", not \"" << text << "\"" << endl;
+		return false;
+	}
+	return true;
+}
+
+void paintStroke(cellLoc mousePos)
+{
+	// Extend the current stroke to the mouse, queueing every cell on the line so fast drags leave no gaps
+	cellLoc cell = screenToCell(mousePos);
+	int dx = abs(cell.x - lastBrush.x), dy = -abs(cell.y - lastBrush.y);
+	int sx = lastBrush.x < cell.x ? 1 : -1, sy = lastBrush.y < cell.y ? 1 : -1;
+	int err = dx + dy;
+	cellLoc point = lastBrush;
+	while (true)
+	{
+		queueBrush(point);
+		if (point == cell)
+		{
+			break;
+		}
+		int e2 = 2 * err;
+		if (e2 >= dy)
+		{
+			err += dy;
+			point.x += sx;
+		}
+		if (e2 <= dx)
+		{
+			err += dx;
+			point.y += sy;
+		}
+	}
+	lastBrush = cell;
+}
+
+vector<cellLoc> patternCells(const vector<string>& rows)
+{
+	// Live cells of a pattern given as rows of live (o) and dead (.) cells, centred on the origin
+	vector<cellLoc> live;
+	for (int y = 0; y < (int)rows.size(); y++)
+	{
+		for (int x = 0; x < (int)rows[y].size(); x++)
+		{
+			if (rows[y][x] == 'o')
+			{
+				live.push_back({ x - (int)rows[y].size() / 2, y - (int)rows.size() / 2 });
+			}
+		}
+	}
+	return live;
+}
+
+bool parseCounts(const string& text, set<int>& counts, map<int, string>& letters)
+{
+	// Parse one half of a rule: neighbor counts, each optionally followed by the Hensel letters it is limited to ("2ak")
+	// or excluded from ("2-ak")
+	for (size_t i = 0; i < text.size();)
+	{
+		if (text[i] < '0' || text[i] > '8')
+		{
+			return false;
+		}
+		int n = text[i++] - '0';
+		const string& all = HENSEL_LETTERS[n > 4 ? 8 - n : n];
+		bool exclude = i < text.size() && text[i] == '-';
+		if (exclude)
+		{
+			i++;
+		}
+		string listed;
+		for (; i < text.size() && isalpha((unsigned char)text[i]); i++)
+		{
+			char letter = (char)tolower((unsigned char)text[i]);
+			if (all.find(letter) == string::npos)
+			{
+				return false;
+			}
+			listed += letter;
+		}
+		if (exclude && listed.empty())
+		{
+			return false;
+		}
+
+		// A count already given in full stays that way; otherwise merge the letters, in notation order
+		map<int, string>::iterator previous = letters.find(n);
+		if (counts.count(n) && previous == letters.end())
+		{
+			continue;
+		}
+		string chosen;
+		for (size_t j = 0; j < all.size(); j++)
+		{
+			bool included = listed.empty() || (listed.find(all[j]) != string::npos) != exclude;
+			if (included || (previous != letters.end() && previous->second.find(all[j]) != string::npos))
+			{
+				chosen += all[j];
+			}
+		}
+		if (chosen == all)
+		{
+			counts.insert(n);
+			letters.erase(n);
+		}
+		else if (!chosen.empty())
+		{
+			counts.insert(n);
+			letters[n] = chosen;
+		}
+	}
+	return true;
+}
+
+bool parseInteger(const string& text, Sint64 low, Sint64 high, Sint64& value)
+{
+	// Read the whole of text as a decimal number from low to high. Unlike stoi() it doesn't throw, so a bad number in a rule or
+	// on the command line is refused like any other mistake.
+	if (text.empty() || !(isdigit((unsigned char)text[0]) || text[0] == '-'))
+	{
+		return false;
+	}
+	char* end = NULL;
+	errno = 0;
+	long long parsed = strtoll(text.c_str(), &end, 10);
+	if (*end != 0 || errno == ERANGE || parsed < low || parsed > high)
+	{
+		return false;
+	}
+	value = parsed;
+	return true;
+}
+
+bool parseRangeRule(const string& rule, ruleSet& parsed)
+{
+	// Parse a Larger than Life rule such as R5,C0,M1,S34..58,B34..45,NM: range, states (0 for two), whether the cell counts itself,
+	// survival and birth count ranges and neighborhood, of which only the Moore square is supported
+	parsed = ruleSet();
+	stringstream fields(rule);
+	string field;
+	Sint64 low[2] = { -1, -1 }, high[2] = { -1, -1 }, number = 0;
+	bool moore = false;
+	while (getline(fields, field, ','))
+	{
+		if (field.size() < 2)
+		{
+			return false;
+		}
+		string value = field.substr(1);
+		if (field[0] == 'S' || field[0] == 'B')
+		{
+			size_t dots = value.find("..");
+			int side = field[0] == 'B' ? 1 : 0;
+			if (dots == string::npos || !parseInteger(value.substr(0, dots), 0, INT_MAX, low[side]) ||
+				!parseInteger(value.substr(dots + 2), 0, INT_MAX, high[side]))
+			{
+				return false;
+			}
+			continue;
+		}
+		if (field[0] == 'N')
+		{
+			moore = value == "M";
+			continue;
+		}
+		if (!parseInteger(value, 0, 999, number))
+		{
+			return false;
+		}
+		if (field[0] == 'R')
+		{
+			parsed.range = (int)number;
+		}
+		else if (field[0] == 'C')
+		{
+			parsed.states = number < 2 ? 2 : (int)number;
+		}
+		else if (field[0] == 'M' && number < 2)
+		{
+			parsed.middle = number == 1;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	if (!moore || parsed.range < 1 || parsed.range > MAX_RANGE || parsed.states > 255 || low[0] < 0 || low[1] < 1)
+	{
+		return false;
+	}
+
+	// Store the counts without the cell itself: a surviving cell counts itself under M1, and a cell being born never does.
+	// No count goes past the whole (2 * range + 1)^2 square, so larger bounds stop there.
+	int most = (2 * parsed.range + 1) * (2 * parsed.range + 1);
+	for (int n = (int)low[0]; n <= min(high[0], (Sint64)most); n++)
+	{
+		parsed.surviveList.insert(n - parsed.middle);
+	}
+	for (int n = (int)low[1]; n <= min(high[1], (Sint64)most); n++)
+	{
+		parsed.birthList.insert(n);
+	}
+	return true;
+}
+
+bool parseRule(const string& text, ruleSet& parsed)
+{
+	// Parse rules in B3/S23 form (either order, any case) or the older S/B form 23/3
+	string rule;
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		if (!isspace((unsigned char)text[i]))
+		{
+			rule += (char)toupper((unsigned char)text[i]);
+		}
+	}
+	if (rule.size() > 1 && rule[0] == 'R' && isdigit((unsigned char)rule[1]))
+	{
+		return parseRangeRule(rule, parsed);
+	}
+	size_t slash = rule.find('/');
+	if (slash == string::npos)
+	{
+		return false;
+	}
+
+	// Generations rules add the number of states as a third part: B2/S/C3, or 345/2/4 in S/B order
+	int states = 2;
+	size_t third = rule.find('/', slash + 1);
+	if (third != string::npos)
+	{
+		string count = rule.substr(third + 1);
+		if (!count.empty() && (count[0] == 'C' || count[0] == 'G'))
+		{
+			count = count.substr(1);
+		}
+		Sint64 number = 0;
+		if (!parseInteger(count, 2, 255, number))
+		{
+			return false;
+		}
+		states = (int)number;
+		rule = rule.substr(0, third);
+	}
+	string first = rule.substr(0, slash), second = rule.substr(slash + 1);
+	string birth, survive;
+	if (!first.empty() && first[0] == 'B')
+	{
+		birth = first.substr(1);
+		survive = second.substr(second.empty() ? 0 : 1);
+	}
+	else if (!first.empty() && first[0] == 'S')
+	{
+		survive = first.substr(1);
+		birth = second.substr(second.empty() ? 0 : 1);
+	}
+	else
+	{
+		survive = first;
+		birth = second;
+	}
+
+	parsed = ruleSet();
+	if (!parseCounts(birth, parsed.birthList, parsed.birthLetters) || !parseCounts(survive, parsed.surviveList, parsed.surviveLetters))
+	{
+		return false;
+	}
+	parsed.states = states;
+
+	// The complemented universe that B0 rules use has no meaning with dying states
+	return states == 2 || parsed.birthList.count(0) == 0;
+}
+
+Uint64 powMod(Uint64 base, Sint64 exponent)
+{
+	// base^exponent mod 2^61 - 1; negative exponents use the inverse base^(p - 2)
+	if (exponent < 0)
+	{
+		base = powMod(base, (Sint64)(HASH_PRIME - 2));
+		exponent = -exponent;
+	}
+	Uint64 result = 1;
+	for (; exponent > 0; exponent >>= 1)
+	{
+		if (exponent & 1)
+		{
+			result = mulMod(result, base);
+		}
+		base = mulMod(base, base);
+	}
+	return result;
+}
+
+void pushKeyframe(historyFrame& entry)
+{
+	// Store the current live cells with a history entry
+	entry.keyframe = true;
+	checkpointTile blocks[64];
+	for (map<cellLoc, shared_ptr<cowTile>>::iterator it = tiles.begin(); it != tiles.end(); it++)
+	{
+		int count = splitTile(it->first, *it->second, blocks);
+		entry.state.insert(entry.state.end(), blocks, blocks + count);
+	}
+	entry.state.shrink_to_fit();
+}
+
+void queueBrush(cellLoc cell)
+{
+	// Queue the brush square centered on cell
+	for (int y = cell.y - (BRUSH_SIZE - 1) / 2; y <= cell.y + BRUSH_SIZE / 2; y++)
+	{
+		for (int x = cell.x - (BRUSH_SIZE - 1) / 2; x <= cell.x + BRUSH_SIZE / 2; x++)
+		{
+			pendingEdits[{x, y}] = brushState;
+		}
+	}
+}
+
+void queueVideoFrame()
+{
+	// Copy the screen into a spare frame and queue it, waiting only if the writer is VIDEO_QUEUE frames behind
+	SDL_Surface* copy = NULL;
+	{
+		unique_lock<mutex> lock(videoLock);
+		if ((int)videoFrames.size() >= VIDEO_QUEUE)
+		{
+			Uint64 waitStart = SDL_GetPerformanceCounter();
+			videoReady.wait(lock, [] { return (int)videoFrames.size() < VIDEO_QUEUE; });
+			videoWaitTicks += SDL_GetPerformanceCounter() - waitStart;
+		}
+		if (!videoSpare.empty())
+		{
+			copy = videoSpare.back();
+			videoSpare.pop_back();
+		}
+	}
+	if (copy == NULL)
+	{
+		copy = SDL_CreateRGBSurfaceWithFormat(0, surface->w, surface->h, surface->format->BitsPerPixel, surface->format->format);
+	}
+	for (int y = 0; y < surface->h; y++)
+	{
+		SDL_memcpy((Uint8*)copy->pixels + y * copy->pitch, (Uint8*)surface->pixels + y * surface->pitch, surface->w * surface->format->BytesPerPixel);
+	}
+	{
+		lock_guard<mutex> lock(videoLock);
+		videoFrames.push_back(copy);
+	}
+	videoReady.notify_all();
+}
+
+vector<cellLoc> randomSoup(int size, double density)
+{
+	// Live cells of a size x size soup centred on the origin, drawn from rng
+	vector<cellLoc> live;
+	vector<Uint64> soup = soupBits(size, size, density);
+	int rowWords = (size + 63) / 64;
+	for (int y = 0; y < size; y++)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			if ((soup[(size_t)y * rowWords + x / 64] >> (x % 64)) & 1)
+			{
+				live.push_back({ x - size / 2, y - size / 2 });
+			}
+		}
+	}
+	return live;
+}
+
+bool readSession(const string& path, vector<string>& args)
+{
+	// Read a recorded session into sessionRecords, returning the command line options it ran with in args and setting its seed
+	ifstream in(path, ios::binary);
+	char magic[8];
+	Uint32 count = 0;
+	if (!in.read(magic, 8) || !equal(magic, magic + 8, SESSION_MAGIC) || !in.read((char*)&RANDOM_SEED, 8) || !in.read((char*)&count, 4))
+	{
+		cout << path << " is not a recorded session" << endl;
+		return false;
+	}
+	for (Uint32 i = 0; i < count; i++)
+	{
+		Uint32 length = 0;
+		in.read((char*)&length, 4);
+		string arg(length, ' ');
+		in.read(&arg[0], length);
+		args.push_back(arg);
+	}
+
+	sessionRecord record;
+	while (in.read((char*)&record.kind, 1) && in.read((char*)&record.frame, 4))
+	{
+		SDL_memset(&record.event, 0, sizeof(record.event));
+		if (record.kind == SESSION_ENGINE)
+		{
+			Uint8 index = 0;
+			in.read((char*)&index, 1);
+			if (in && index >= sizeof(ENGINES) / sizeof(ENGINES[0]))
+			{
+				cout << path << " is not a recorded session: engine " << (int)index << " does not exist" << endl;
+				sessionRecords.clear();
+				return false;
+			}
+			record.engine = index;
+		}
+		else if (record.kind == SESSION_EVENT)
+		{
+			in.read((char*)&record.event.type, 4);
+			switch (record.event.type)
+			{
+			case SDL_KEYDOWN:
+				in.read((char*)&record.event.key.keysym.sym, 4);
+				in.read((char*)&record.event.key.keysym.mod, 2);
+				break;
+			case SDL_MOUSEBUTTONDOWN:
+				in.read((char*)&record.event.button.button, 1);
+				in.read((char*)&record.event.button.x, 4);
+				in.read((char*)&record.event.button.y, 4);
+				break;
+			case SDL_MOUSEMOTION:
+				in.read((char*)&record.event.motion.state, 4);
+				in.read((char*)&record.event.motion.x, 4);
+				in.read((char*)&record.event.motion.y, 4);
+				break;
+			case SDL_DROPFILE:
+				Uint32 length = 0;
+				in.read((char*)&length, 4);
+				record.file.assign(length, ' ');
+				in.read(&record.file[0], length);
+				break;
+			}
+		}
+		if (!in)
+		{
+			break;
+		}
+		sessionRecords.push_back(record);
+	}
+	cout << "Replaying " << path << ": " << sessionRecords.size() << " records, random seed " << RANDOM_SEED << endl;
+	return true;
+}
+
+void recordHistory()
+{
+	// Close off this generation's changes as a history entry, then trim the oldest keyframe spans while over the memory cap
+	if (HISTORY_MEMORY == 0 || rules.states > 2)
+	{
+		// Change lists and keyframes only record which cells are on
+		return;
+	}
+	historyFrame entry = { frame, false, inverted, {}, encodeChanges(currentChanges) };
+	currentChanges.clear();
+	if (history.empty() || frame % HISTORY_KEYFRAME == 0)
+	{
+		pushKeyframe(entry);
+	}
+	historyBytes += sizeof(historyFrame) + entry.changes.size() + entry.state.size() * sizeof(checkpointTile);
+	history.push_back(move(entry));
+
+	while (historyBytes > HISTORY_MEMORY * 1048576)
+	{
+		// Drop everything before the second keyframe, if there is one
+		deque<historyFrame>::iterator next = find_if(history.begin() + 1, history.end(), [](const historyFrame& h) { return h.keyframe; });
+		if (next == history.end())
+		{
+			break;
+		}
+		for (deque<historyFrame>::iterator it = history.begin(); it != next; it++)
+		{
+			historyBytes -= sizeof(historyFrame) + it->changes.size() + it->state.size() * sizeof(checkpointTile);
+		}
+		history.erase(history.begin(), next);
+	}
+}
+
+void recordSession(Uint8 kind, const SDL_Event* event)
+{
+	// Append a record to the session being recorded: its kind and generation, then what the kind needs. Events that
+	// handleEvent() ignores are left out.
+	if (!sessionOut.is_open())
+	{
+		return;
+	}
+	if (kind == SESSION_EVENT && event->type != SDL_QUIT && event->type != SDL_KEYDOWN && event->type != SDL_MOUSEBUTTONDOWN &&
+		!(event->type == SDL_MOUSEMOTION && (event->motion.state & SDL_BUTTON_LMASK)) && event->type != SDL_DROPFILE)
+	{
+		return;
+	}
+	Sint32 at = frame;
+	sessionOut.write((const char*)&kind, 1);
+	sessionOut.write((const char*)&at, 4);
+	if (kind == SESSION_ENGINE)
+	{
+		Uint8 index = 0;
+		while (ENGINES[index] != universe)
+		{
+			index++;
+		}
+		sessionOut.write((const char*)&index, 1);
+	}
+	else if (kind == SESSION_EVENT)
+	{
+		sessionOut.write((const char*)&event->type, 4);
+		switch (event->type)
+		{
+		case SDL_KEYDOWN:
+			sessionOut.write((const char*)&event->key.keysym.sym, 4);
+			sessionOut.write((const char*)&event->key.keysym.mod, 2);
+			break;
+		case SDL_MOUSEBUTTONDOWN:
+			sessionOut.write((const char*)&event->button.button, 1);
+			sessionOut.write((const char*)&event->button.x, 4);
+			sessionOut.write((const char*)&event->button.y, 4);
+			break;
+		case SDL_MOUSEMOTION:
+			sessionOut.write((const char*)&event->motion.state, 4);
+			sessionOut.write((const char*)&event->motion.x, 4);
+			sessionOut.write((const char*)&event->motion.y, 4);
+			break;
+		case SDL_DROPFILE:
+			Uint32 length = (Uint32)SDL_strlen(event->drop.file);
+			sessionOut.write((const char*)&length, 4);
+			sessionOut.write(event->drop.file, length);
+			break;
+		}
+	}
+}
+
+void removeCells()
+{
+	// Remove inactive cells with no neighbors
+	for (size_t i = 0; i < cellsToRemove.size(); i++)
+	{
+		map<cellLoc, cellData>::iterator it = cells.find(cellsToRemove[i]);
+		if (it != cells.end() && it->second.currState == 0 && it->second.neighbors == 0)
+		{
+			cells.erase(it);
+		}
+	}
+}
+
+bool replaySession(bool& running, bool& paused, bool& singleFrame, double fps)
+{
+	// Replay the records due at this generation, up to the end of a frame's events, and say whether to step on towards the next.
+	// Records are due when the session reached their generation, which a rewind may have taken back.
+	while (sessionNext < sessionRecords.size() && sessionRecords[sessionNext].frame <= frame)
+	{
+		sessionRecord& record = sessionRecords[sessionNext++];
+		if (record.kind == SESSION_EVENT)
+		{
+			SDL_Event event = record.event;
+			if (event.type == SDL_DROPFILE)
+			{
+				// handleEvent() frees it, as SDL would have allocated it
+				event.drop.file = SDL_strdup(record.file.c_str());
+			}
+			handleEvent(event, running, paused, singleFrame, fps);
+			sessionEvents++;
+		}
+		else if (record.kind == SESSION_ENGINE)
+		{
+			switchEngine(ENGINES[record.engine]);
+			moveScreen(center);
+		}
+		else if (record.kind == SESSION_APPLY)
+		{
+			break;
+		}
+	}
+	return sessionNext < sessionRecords.size() && sessionRecords[sessionNext].frame > frame;
+}
+
+string ruleString(const ruleSet& r)
+{
+	// B/S notation for a rule, as written to pattern files
+	if (r.range > 1)
+	{
+		// Larger than Life notation, with a surviving cell counting itself under M1
+		return "R" + to_string(r.range) + ",C" + to_string(r.states > 2 ? r.states : 0) + ",M" + (r.middle ? "1" : "0") +
+			",S" + to_string(*r.surviveList.begin() + r.middle) + ".." + to_string(*r.surviveList.rbegin() + r.middle) +
+			",B" + to_string(*r.birthList.begin()) + ".." + to_string(*r.birthList.rbegin()) + ",NM";
+	}
+	string text = "B";
+	for (set<int>::iterator n = r.birthList.begin(); n != r.birthList.end(); n++)
+	{
+		text += to_string(*n) + (r.birthLetters.count(*n) ? r.birthLetters.at(*n) : "");
+	}
+	text += "/S";
+	for (set<int>::iterator n = r.surviveList.begin(); n != r.surviveList.end(); n++)
+	{
+		text += to_string(*n) + (r.surviveLetters.count(*n) ? r.surviveLetters.at(*n) : "");
+	}
+	if (r.states > 2)
+	{
+		text += "/C" + to_string(r.states);
+	}
+	return text;
+}
+
+int runBenchmark(const string& path, const string& baseline, const string& patternFile)
+{
+	// Time the corpus (the --verify patterns, a seeded soup and any pattern file given) on every engine that can run the rule,
+	// and write gens/s, time per phase and the final state of each to path as JSON. Engines must agree with the map engine
+	// on every final state, and with baseline, if given, on both state and speed. Returns the number of failures.
+	vector<pair<string, vector<cellLoc>>> corpus;
+	for (map<string, vector<string>>::iterator pattern = VERIFY_PATTERNS.begin(); pattern != VERIFY_PATTERNS.end(); pattern++)
+	{
+		corpus.push_back({ pattern->first, patternCells(pattern->second) });
+	}
+	rng.seed(RANDOM_SEED);
+	size_t soup = corpus.size();
+	corpus.push_back({ to_string(BENCH_SOUP) + "x" + to_string(BENCH_SOUP) + " soup", randomSoup(BENCH_SOUP, SOUP_DENSITY) });
+	if (!patternFile.empty())
+	{
+		// The file's rule applies to the whole corpus
+		if (!loadPattern(patternFile))
+		{
+			return 1;
+		}
+		vector<pair<cellLoc, int>> found;
+		universe->viewport({ INT_MIN, INT_MIN }, { INT_MAX, INT_MAX }, found);
+		vector<cellLoc> live;
+		for (size_t i = 0; i < found.size(); i++)
+		{
+			if (found[i].second == 1)
+			{
+				live.push_back(found[i].first);
+			}
+		}
+		corpus.push_back({ patternFile, live });
+	}
+
+	// Trials go round the whole corpus in turn, so that a machine slowing down or speeding up during the benchmark widens every
+	// confidence interval rather than shifting whichever measurements happened to be running
+	vector<benchResult> results;
+	vector<pair<engine*, size_t>> runs;		// Engine and corpus entry of each result
+	for (size_t i = 0; i < corpus.size(); i++)
+	{
+		for (int e = 0; e < (int)(sizeof(ENGINES) / sizeof(ENGINES[0])); e++)
+		{
+			if (ENGINES[e]->supports(rules))
+			{
+				benchResult result;
+				result.pattern = corpus[i].first;
+				result.engine = ENGINES[e]->name();
+				results.push_back(result);
+				runs.push_back({ ENGINES[e], i });
+			}
+		}
+	}
+
+	// The soup again on the map engine with dying states added to a two state rule, so the cost of Generations rules can be read
+	// against the rule without them. Its trials swap the rule in and out around each run.
+	ruleSet dying = rules;
+	dying.states = BENCH_DYING_STATES;
+	size_t dyingRun = results.size();
+	if (rules.states == 2 && rules.range == 1 && rules.birthList.count(0) == 0)
+	{
+		benchResult result;
+		result.pattern = corpus[soup].first + " as " + ruleString(dying);
+		result.engine = mapUniverse.name();
+		results.push_back(result);
+		runs.push_back({ &mapUniverse, soup });
+	}
+	int failures = 0;
+	vector<bool> failed(results.size(), false);
+	for (int trial = -1; trial < BENCH_TRIALS; trial++)
+	{
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			if (i == dyingRun)
+			{
+				swap(rules, dying);
+				compileRule();
+			}
+			if (!failed[i] && !benchTrial(runs[i].first, corpus[runs[i].second].second, results[i]))
+			{
+				failed[i] = true;
+				failures++;
+			}
+			if (i == dyingRun)
+			{
+				swap(rules, dying);
+				compileRule();
+			}
+		}
+	}
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		double interval, mean = confidence(results[i].rates, interval);
+		cout << results[i].pattern << " on " << results[i].engine << ": " << mean << " +/- " << interval << " gens/s, population " << results[i].population << endl;
+		if (i > 0 && results[i - 1].pattern == results[i].pattern && (results[i - 1].population != results[i].population || results[i - 1].hash != results[i].hash))
+		{
+			cout << results[i].pattern << ": the " << results[i].engine << " engine ends in a different state from " << results[i - 1].engine << endl;
+			failures++;
+		}
+	}
+
+	ofstream out(path);
+	out << "{\n\t\"rule\": " << jsonQuote(ruleString(rules)) << ",\n\t\"seed\": " << RANDOM_SEED << ",\n\t\"generations\": " << BENCH_GENERATIONS <<
+		",\n\t\"trials\": " << BENCH_TRIALS << ",\n\t\"results\": [\n";
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		// One result per line, which is how --compare reads them back
+		double interval, mean = confidence(results[i].rates, interval);
+		out << "\t\t{\"pattern\": " << jsonQuote(results[i].pattern) << ", \"engine\": " << jsonQuote(results[i].engine) <<
+			", \"gensPerSecond\": " << mean << ", \"interval\": " << interval << ", \"rates\": [";
+		for (size_t t = 0; t < results[i].rates.size(); t++)
+		{
+			out << (t ? ", " : "") << results[i].rates[t];
+		}
+		out << "], \"phases\": {";
+		for (map<string, double>::iterator phase = results[i].phases.begin(); phase != results[i].phases.end(); phase++)
+		{
+			out << (phase != results[i].phases.begin() ? ", " : "") << jsonQuote(phase->first) << ": " << phase->second;
+		}
+		out << "}, \"population\": " << results[i].population << ", \"finalHash\": \"" << hex << results[i].hash << dec << "\"}" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "\t]\n}\n";
+	out.close();
+	cout << "Wrote " << path << ": " << results.size() << " results of " << BENCH_TRIALS << " trials" << endl;
+
+	if (!baseline.empty())
+	{
+		failures += compareBenchmark(baseline, results);
+	}
+	return failures;
+}
+
+int runLatency(Sint64 maxCells)
+{
+	// Replay synthetic events through handleEvent() against soups growing tenfold from 1000 live cells up to maxCells, drawing to
+	// the offscreen surface, and report the latency of each operation from its event to its edits being applied. The operations
+	// are shuffled together; pans go round in a square and zooms go in and back out, so the view stays on the soup.
+	const string names[4] = { "pan", "zoom", "toggle", "random fill" };
+	const SDL_Keycode arrows[4] = { SDLK_LEFT, SDLK_UP, SDLK_RIGHT, SDLK_DOWN };
+	bool running = true, paused = true, singleFrame = false;
+	for (Sint64 live = 1000; live <= maxCells; live *= 10)
+	{
+		inverted = false;
+		universe->clear();
+		center = { 0, 0 };
+		rng.seed(RANDOM_SEED);
+		vector<cellLoc> soup = randomSoup((int)ceil(sqrt(live / SOUP_DENSITY)), SOUP_DENSITY);
+		universe->load(soup);
+		moveScreen(center);
+
+		vector<int> order;
+		for (int i = 0; i < LATENCY_SAMPLES * 4; i++)
+		{
+			order.push_back(i % 4);
+		}
+		for (int i = (int)order.size() - 1; i > 0; i--)
+		{
+			swap(order[i], order[rng.next() % (i + 1)]);
+		}
+
+		vector<double> samples[4];
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			int op = order[i];
+			int count = (int)samples[op].size();
+			SDL_Event event;
+			SDL_memset(&event, 0, sizeof(event));
+			event.type = SDL_KEYDOWN;
+			if (op == 0)
+			{
+				event.key.keysym.sym = arrows[count % 4];
+			}
+			else if (op == 1)
+			{
+				event.key.keysym.sym = count % 2 ? SDLK_PAGEDOWN : SDLK_PAGEUP;
+			}
+			else if (op == 2)
+			{
+				event.type = SDL_MOUSEBUTTONDOWN;
+				event.button.button = SDL_BUTTON_LEFT;
+				event.button.x = (int)(rng.next() % WIDTH);
+				event.button.y = (int)(rng.next() % HEIGHT);
+			}
+			else
+			{
+				event.key.keysym.sym = SDLK_r;
+			}
+
+			// As in the main loop: the event, then the frame's edits
+			Uint64 start = SDL_GetPerformanceCounter();
+			handleEvent(event, running, paused, singleFrame, 0);
+			if (!pendingEdits.empty())
+			{
+				applyEdits();
+			}
+			samples[op].push_back((SDL_GetPerformanceCounter() - start) * 1000.0 / perfFrequency);
+		}
+
+		for (int op = 0; op < 4; op++)
+		{
+			sort(samples[op].begin(), samples[op].end());
+			size_t n = samples[op].size();	// Nearest rank percentiles
+			cout << live << " cells on " << universe->name() << ", " << names[op] << ": p50 " << samples[op][(n + 1) / 2 - 1] << " ms, p99 " <<
+				samples[op][(n * 99 + 99) / 100 - 1] << " ms, max " << samples[op].back() << " ms" << endl;
+		}
+	}
+	return 0;
+}
+
+int runScaling(const string& path, Sint64 maxCells)
+{
+	// Sweep each engine through soups growing tenfold from SCALE_MIN_CELLS to maxCells on one thread, then through 1 to
+	// STEP_THREADS threads on a fixed soup (strong scaling) and on a soup that grows with the threads (weak scaling). Each point
+	// goes to path as a CSV row for plotting, and each sweep is summed up by where its throughput (live cells times gens/s)
+	// stops growing. Points predicted to pass SCALE_MEMORY or SCALE_SECONDS, judged from the one before, are skipped.
+	vector<scalePoint> points;
+	vector<int> threadCounts;
+	for (int t = 1; t < STEP_THREADS; t *= 2)
+	{
+		threadCounts.push_back(t);
+	}
+	threadCounts.push_back(STEP_THREADS);
+
+	for (int e = 0; e < (int)(sizeof(ENGINES) / sizeof(ENGINES[0])); e++)
+	{
+		if (!ENGINES[e]->supports(rules))
+		{
+			continue;
+		}
+		for (int sweep = 0; sweep < 3; sweep++)
+		{
+			const string names[3] = { "size", "strong", "weak" };
+			vector<scalePoint> found;
+			double seconds = 0;
+			for (size_t i = 0; ; i++)
+			{
+				// The next point's soup and threads
+				Sint64 live = sweep == 0 ? SCALE_MIN_CELLS : (sweep == 1 ? min(SCALE_STRONG, maxCells) : min(SCALE_WEAK, maxCells));
+				int threads = 1;
+				for (size_t k = 0; k < i; k++)
+				{
+					live *= sweep == 0 ? 10 : 1;
+				}
+				if (sweep == 0 ? live > maxCells : i >= threadCounts.size())
+				{
+					break;
+				}
+				if (sweep > 0)
+				{
+					threads = threadCounts[i];
+					live *= sweep == 2 ? threads : 1;
+				}
+
+				scalePoint point;
+				point.sweep = names[sweep];
+				point.engine = ENGINES[e]->name();
+				if (!found.empty())
+				{
+					double growth = (double)live / found.back().population;
+					double megabytes = found.back().bytes * growth / 1048576;
+					if (megabytes > SCALE_MEMORY || seconds * growth > SCALE_SECONDS)
+					{
+						cout << point.engine << " engine, " << point.sweep << " sweep: stopping before " << live << " cells, predicted to need " <<
+							(int)megabytes << " MB and " << (int)(seconds * growth) << " s" << endl;
+						break;
+					}
+				}
+				if (!scaleRun(ENGINES[e], live, threads, point, seconds))
+				{
+					cout << point.engine << " engine, " << point.sweep << " sweep: " << live << " cells don't fit" << endl;
+					break;
+				}
+				found.push_back(point);
+				cout << point.engine << " engine, " << point.sweep << " sweep: " << point.population << " cells on " << threads << " threads, " <<
+					point.rate << " gens/s, " << (double)point.bytes / point.population << " bytes per cell" << endl;
+			}
+
+			// Efficiency, and where the throughput flattens
+			double peak = 0;
+			size_t flat = found.size();
+			for (size_t i = 0; i < found.size(); i++)
+			{
+				double throughput = found[i].population * found[i].rate;
+				peak = max(peak, throughput);
+				if (flat == found.size() && i > 0 && throughput < SCALE_FLAT * found[i - 1].population * found[i - 1].rate)
+				{
+					flat = i;
+				}
+			}
+			for (size_t i = 0; i < found.size(); i++)
+			{
+				double throughput = found[i].population * found[i].rate;
+				found[i].efficiency = sweep == 0 ? throughput / peak : throughput / (found[i].threads * found[0].population * found[0].rate);
+				points.push_back(found[i]);
+			}
+			if (!found.empty())
+			{
+				cout << found[0].engine << " engine, " << names[sweep] << " sweep: throughput ";
+				if (flat == found.size())
+				{
+					cout << "still growing at " << found.back().population << " cells on " << found.back().threads << " threads" << endl;
+				}
+				else
+				{
+					cout << "flattens at " << found[flat].population << " cells on " << found[flat].threads << " threads, efficiency " << found[flat].efficiency << endl;
+				}
+			}
+		}
+	}
+
+	ofstream out(path);
+	out << "sweep,engine,threads,live cells,gens/s,cell gens/s,efficiency,bytes,bytes per cell\n";
+	for (size_t i = 0; i < points.size(); i++)
+	{
+		out << points[i].sweep << ',' << points[i].engine << ',' << points[i].threads << ',' << points[i].population << ',' << points[i].rate << ',' <<
+			points[i].population * points[i].rate << ',' << points[i].efficiency << ',' << points[i].bytes << ',' << (double)points[i].bytes / points[i].population << '\n';
+	}
+	out.close();
+	cout << "Wrote " << path << ": " << points.size() << " points" << endl;
+	return 0;
+}
+
+int runVerify(int generations)
+{
+	// Differential test: run every rule in RULES on the curated patterns and two random soups through every engine in lockstep
+	// with the reference engine, which applies the rule as written. Returns the number of runs that diverged.
+	Uint64 start = SDL_GetPerformanceCounter();
+	int runs = 0, failures = 0, skipped = 0;
+	vector<pair<string, string>> ruleTexts;
+	for (map<string, ruleSet>::iterator rule = RULES.begin(); rule != RULES.end(); rule++)
+	{
+		ruleTexts.push_back({ rule->first, ruleString(rule->second) });
+	}
+	for (size_t i = 0; i < VERIFY_RANGE_RULES.size(); i++)
+	{
+		ruleTexts.push_back({ VERIFY_RANGE_RULES[i], VERIFY_RANGE_RULES[i] });
+	}
+	for (size_t i = 0; i < VERIFY_HENSEL_RULES.size(); i++)
+	{
+		ruleTexts.push_back({ VERIFY_HENSEL_RULES[i], VERIFY_HENSEL_RULES[i] });
+	}
+	for (vector<pair<string, string>>::iterator rule = ruleTexts.begin(); rule != ruleTexts.end(); rule++)
+	{
+		if (!setRule(rule->second))
+		{
+			skipped++;
+			continue;
+		}
+		vector<pair<string, vector<cellLoc>>> starts;
+		for (map<string, vector<string>>::iterator pattern = VERIFY_PATTERNS.begin(); pattern != VERIFY_PATTERNS.end(); pattern++)
+		{
+			starts.push_back({ pattern->first, patternCells(pattern->second) });
+		}
+		for (int soup = 0; soup < 2; soup++)
+		{
+			// Soups at two densities from a fixed seed, so failures reproduce
+			rng.seed(RANDOM_SEED + soup);
+			starts.push_back({ string(soup ? "50%" : "30%") + " soup", randomSoup(VERIFY_SOUP, soup ? 0.5 : 0.3) });
+		}
+		if (rules.range > 1)
+		{
+			// Larger than Life counts neighbors over tiles around the pattern, which must not span the gap between far apart parts
+			rng.seed(RANDOM_SEED + 2);
+			vector<cellLoc> apart = randomSoup(VERIFY_SOUP / 2, 0.5);
+			for (size_t i = 0, n = apart.size(); i < n; i++)
+			{
+				apart.push_back({ apart[i].x + VERIFY_DISTANCE, apart[i].y + VERIFY_DISTANCE });
+			}
+			starts.push_back({ "two soups " + to_string(VERIFY_DISTANCE) + " cells apart", apart });
+		}
+
+		for (size_t i = 0; i < starts.size(); i++)
+		{
+			runs++;
+			if (!verifyRun(rule->first + ", " + starts[i].first, starts[i].second, generations))
+			{
+				failures++;
+			}
+		}
+	}
+
+	// Checkpoints of two state rules the header's bitmasks can't hold, which carry the rule as text
+	for (vector<pair<string, string>>::iterator rule = ruleTexts.begin(); rule != ruleTexts.end(); rule++)
+	{
+		ruleSet parsed;
+		if (parseRule(rule->second, parsed) && parsed.states == 2 && (parsed.range > 1 || !parsed.birthLetters.empty() || !parsed.surviveLetters.empty()))
+		{
+			runs++;
+			failures += !verifyCheckpoint(rule->second);
+		}
+	}
+	cout << "Verified " << runs << " runs of " << generations << " generations (" << skipped << " rules skipped) in " <<
+		(SDL_GetPerformanceCounter() - start) * 1000 / SDL_GetPerformanceFrequency() << " ms: " << (failures ? to_string(failures) + " diverged" : "all engines agree") << endl;
+	return failures;
+}
+
+void resetCycles()
+{
+	// Forget remembered generations, e.g. after an edit breaks the chain of steps between them
+	recentStates.clear();
+	recentShapes.clear();
+	recentOrder.clear();
+	cycle = { 0, 0, 0 };
+}
+
+void resetHistory()
+{
+	// Forget all history, e.g. when a pattern file replaces the universe
+	history.clear();
+	currentChanges.clear();
+	historyBytes = 0;
+}
+
+void saveCheckpoint(const string& path)
+{
+	// Snapshot the tile set (copying only pointers) and write it on a background thread. Tiles changed while it is written are copied then.
+	if (checkpointBusy)
+	{
+		cout << "Previous checkpoint still being written, skipping" << endl;
+		return;
+	}
+	if (rules.states > 2)
+	{
+		// The checkpoint tiles only record which cells are on
+		cout << "Checkpoints only hold two state universes, skipping" << endl;
+		return;
+	}
+	if (universe != &mapUniverse)
+	{
+		// The tiles are kept up to date by the map engine
+		cout << "Checkpoints are only written from the map engine, skipping" << endl;
+		return;
+	}
+	if (checkpointThread.joinable())
+	{
+		checkpointThread.join();
+	}
+
+	// The bitmasks hold totalistic rules of the 3x3 neighborhood; others are written out as text as well
+	checkpointHeader header = {};
+	copy(CHECKPOINT_MAGIC, CHECKPOINT_MAGIC + sizeof(CHECKPOINT_MAGIC), header.magic);
+	for (set<int>::iterator n = rules.birthList.begin(); n != rules.birthList.end() && *n <= 8; n++)
+	{
+		header.birth |= 1 << *n;
+	}
+	for (set<int>::iterator n = rules.surviveList.begin(); n != rules.surviveList.end() && *n <= 8; n++)
+	{
+		header.survive |= 1 << *n;
+	}
+	header.frame = frame;
+	header.centerX = center.x;
+	header.centerY = center.y;
+	header.cellSize = CELL_SIZE;
+	header.flags = inverted ? CHECKPOINT_INVERTED : 0;
+	header.topology = topology;
+	header.boundsW = boundsW;
+	header.boundsH = boundsH;
+	if (!rules.birthLetters.empty() || !rules.surviveLetters.empty() || rules.range > 1)
+	{
+		header.flags |= CHECKPOINT_RULE_TEXT;
+	}
+
+	snapshotEpoch++;
+	checkpointCopies = 0;
+	checkpointBusy = true;
+	checkpointThread = thread(writeCheckpoint, path, tiles, header, ruleString(rules));
+}
+
+bool scaleRun(engine* e, Sint64 live, int threads, scalePoint& point, double& seconds)
+{
+	// Load a square soup of about live cells into e, loaded a batch at a time so the largest never sit in one vector, and step it
+	// for SCALE_TIME after a generation to warm up. seconds is set to the whole run's time. Returns false if e lost cells to its
+	// size limit.
+	Uint64 begin = SDL_GetPerformanceCounter();
+	inverted = false;
+	e->clear();
+	e->setThreads(threads);
+	point.threads = threads;
+	int side = (int)ceil(sqrt(live / SOUP_DENSITY));
+	rng.seed(RANDOM_SEED);
+	vector<cellLoc> batch;
+	for (int y = 0; y < side; y++)
+	{
+		vector<Uint64> row = soupBits(side, 1, SOUP_DENSITY);
+		for (int x = 0; x < side; x++)
+		{
+			if ((row[x / 64] >> (x % 64)) & 1)
+			{
+				batch.push_back({ x - side / 2, y - side / 2 });
+			}
+		}
+		if (batch.size() >= LOAD_BATCH || y == side - 1)
+		{
+			e->load(batch);
+			batch.clear();
+		}
+	}
+	point.population = e->population();
+	if (point.population < live / 2)
+	{
+		return false;
+	}
+
+	e->step(1);
+	Uint64 start = SDL_GetPerformanceCounter(), now = start;
+	int generations = 0;
+	while (now - start < SCALE_TIME * perfFrequency / 1000)
+	{
+		e->step(1);
+		generations++;
+		now = SDL_GetPerformanceCounter();
+	}
+	point.rate = generations * (double)perfFrequency / (now - start);
+	point.bytes = e->memory();
+	seconds = (double)(now - begin) / perfFrequency;
+	e->setThreads(STEP_THREADS);
+	return true;
+}
+
+cellLoc screenToCell(cellLoc mousePos)
+{
+	return { mousePos.x / (int)(CELL_SIZE + 1) + topLeft.x, mousePos.y / (int)(CELL_SIZE + 1) + topLeft.y };
+}
+
+bool seekHistory(int target)
+{
+	// Go back to generation target: rebuild the live cells from the nearest keyframe at or before it plus the change lists after,
+	// then discard the history after target
+	Uint64 start = SDL_GetPerformanceCounter();
+	deque<historyFrame>::iterator keyframe = history.end();
+	for (deque<historyFrame>::iterator it = history.begin(); it != history.end() && it->frame <= target; it++)
+	{
+		if (it->keyframe)
+		{
+			keyframe = it;
+		}
+	}
+	if (keyframe == history.end())
+	{
+		cout << "Generation " << target << " is no longer in the history" << endl;
+		return false;
+	}
+
+	set<cellLoc> live;
+	for (size_t t = 0; t < keyframe->state.size(); t++)
+	{
+		for (int i = 0; i < 64; i++)
+		{
+			if ((keyframe->state[t].bits >> i) & 1)
+			{
+				live.insert({ keyframe->state[t].x * 8 + i % 8, keyframe->state[t].y * 8 + i / 8 });
+			}
+		}
+	}
+	bool targetInverted = keyframe->inverted;
+	deque<historyFrame>::iterator it = keyframe + 1;
+	for (; it != history.end() && it->frame <= target; it++)
+	{
+		decodeChanges(it->changes, live);
+		targetInverted = it->inverted;
+	}
+	for (deque<historyFrame>::iterator dropped = it; dropped != history.end(); dropped++)
+	{
+		historyBytes -= sizeof(historyFrame) + dropped->changes.size() + dropped->state.size() * sizeof(checkpointTile);
+	}
+	history.erase(it, history.end());
+
+	replaying = true;
+	clearUniverse();
+	vector<cellLoc> batch(live.begin(), live.end());
+	addCells(batch);
+	replaying = false;
+	currentChanges.clear();
+	frame = target;
+	inverted = targetInverted;
+	resetCycles();
+
+	seekTime = (double)(SDL_GetPerformanceCounter() - start) * 1000 / SDL_GetPerformanceFrequency();
+	return true;
+}
+
+void setBoundedNextState()
+{
+	// Step the bit array, then queue the cells that changed so the usual update pass mirrors them into cells. trackChange()
+	// writes each one back to the new current generation, where it is already set.
+	boundedGrid.step(1);
+	for (int y = 0; y < boundsH; y++)
+	{
+		for (int i = 0; i < boundedGrid.words; i++)
+		{
+			size_t index = (size_t)y * boundedGrid.words + i;
+			for (Uint64 diff = boundedGrid.bits[0][index] ^ boundedGrid.bits[1][index]; diff != 0; diff &= diff - 1)
+			{
+				int bit = (int)bitset<64>((diff & (0 - diff)) - 1).count();
+				cellLoc loc = { boundsCorner.x + i * 64 + bit, boundsCorner.y + y };
+				cells[loc].nextState = (int)((boundedGrid.bits[0][index] >> bit) & 1);
+				cellsToUpdate.push_back(loc);
+			}
+		}
+	}
+}
+
+void setNextState()
+{
+	// Evaluate the cells of awake tiles. A sleeping tile repeats last generation's toggles, which for period 1 or 2 are the same
+	// as the ones it would compute; Generations rules evaluate every tile, as replaying toggles only works for two states.
+	const int size = 1 << ACTIVITY_SHIFT;
+	awakeTiles = 0;
+	for (map<cellLoc, tileActivity>::iterator tile = activity.begin(); tile != activity.end(); tile++)
+	{
+		if (!tile->second.awake && tile->second.wake == 0 && rules.states == 2)
+		{
+			for (size_t i = 0; i < tile->second.toggled[1].size(); i++)
+			{
+				map<cellLoc, cellData>::iterator it = cells.find(tile->second.toggled[1][i]);
+				if (it != cells.end())
+				{
+					it->second.nextState = 1 - it->second.currState;
+					cellsToUpdate.push_back(it->first);
+				}
+			}
+			continue;
+		}
+
+		awakeTiles++;
+		int x0 = tile->first.x * size, y0 = tile->first.y * size;
+		map<cellLoc, cellData>::iterator it = cells.end();
+		for (int x = x0; x < x0 + size; x++)
+		{
+			// Where the last column ran straight into this one, the search for its first cell is already done
+			if (it == cells.end() || it->first.x != x || it->first.y < y0)
+			{
+				it = cells.lower_bound({ x, y0 });
+			}
+			for (; it != cells.end() && it->first.x == x && it->first.y < y0 + size; it++)
+			{
+				if (it->second.currState > 1)
+				{
+					// Dying cells of Generations rules advance a state every generation
+					it->second.nextState = (it->second.currState + 1) % rules.states;
+					cellsToUpdate.push_back(it->first);
+				}
+				else if (it->second.currState == 1)
+				{
+					if (!phaseTables[inverted][it->second.neighbors | 16])
+					{
+						it->second.nextState = rules.states > 2 ? 2 : 0;
+						cellsToUpdate.push_back(it->first);
+					}
+				}
+				else if (phaseTables[inverted][it->second.neighbors])
+				{
+					it->second.nextState = 1;
+					cellsToUpdate.push_back(it->first);
+				}
+			}
+		}
+	}
+}
+
+void setRangeNextState()
+{
+	// Larger than Life: count each cell's neighbors from a summed-area table, so the cost per cell doesn't depend on the range.
+	// Tables are built per 64x64 tile, over the tile grown by the range and filled from the tiles around it, for the tiles
+	// holding a cell not in state 0 and their neighbors (as far as births reach), so the cost follows the population rather
+	// than the area the pattern spans.
+	int r = rules.range;
+	map<cellLoc, vector<Uint8>> occupied;	// States of each tile's cells, row by row
+	set<cellLoc> counted;
+	for (map<cellLoc, cellData>::iterator it = cells.begin(); it != cells.end(); it++)
+	{
+		if (it->second.currState != 0)
+		{
+			cellLoc tile = { it->first.x >> 6, it->first.y >> 6 };
+			vector<Uint8>& states = occupied[tile];
+			if (states.empty())
+			{
+				states.assign(64 * 64, 0);
+				for (int dy = -1; dy <= 1; dy++)
+				{
+					for (int dx = -1; dx <= 1; dx++)
+					{
+						counted.insert({ tile.x + dx, tile.y + dy });
+					}
+				}
+			}
+			states[(it->first.y & 63) * 64 + (it->first.x & 63)] = (Uint8)it->second.currState;
+		}
+	}
+
+	// Counts here leave out the cell itself
+	int maxCount = (2 * r + 1) * (2 * r + 1);
+	vector<Uint8> born(maxCount + 1, 0), survives(maxCount + 1, 0);
+	for (int n = 0; n <= maxCount; n++)
+	{
+		born[n] = rules.birthList.count(n) > 0;
+		survives[n] = rules.surviveList.count(n) > 0;
+	}
+
+	// states and sums cover the tile grown by r on each side; sums[(y + 1) * (side + 1) + x + 1] holds the live cells in the
+	// rectangle from its corner to (x, y)
+	int side = 64 + 2 * r;
+	vector<Uint8> states((size_t)side * side);
+	vector<int> sums((size_t)(side + 1) * (side + 1), 0);
+	for (set<cellLoc>::iterator tile = counted.begin(); tile != counted.end(); tile++)
+	{
+		fill(states.begin(), states.end(), 0);
+		for (int ty = -1; ty <= 1; ty++)
+		{
+			for (int tx = -1; tx <= 1; tx++)
+			{
+				map<cellLoc, vector<Uint8>>::iterator source = occupied.find({ tile->x + tx, tile->y + ty });
+				if (source == occupied.end())
+				{
+					continue;
+				}
+				// Cell (cx, cy) of this neighbor is at (cx + offsetX, cy + offsetY) in states
+				int offsetX = tx * 64 + r, offsetY = ty * 64 + r;
+				for (int cy = max(-offsetY, 0); cy < min(64, side - offsetY); cy++)
+				{
+					for (int cx = max(-offsetX, 0); cx < min(64, side - offsetX); cx++)
+					{
+						states[(size_t)(cy + offsetY) * side + cx + offsetX] = source->second[cy * 64 + cx];
+					}
+				}
+			}
+		}
+		for (int y = 0; y < side; y++)
+		{
+			int rowSum = 0;
+			for (int x = 0; x < side; x++)
+			{
+				rowSum += states[(size_t)y * side + x] == 1;
+				sums[(size_t)(y + 1) * (side + 1) + x + 1] = sums[(size_t)y * (side + 1) + x + 1] + rowSum;
+			}
+		}
+
+		for (int y = r; y < r + 64; y++)
+		{
+			for (int x = r; x < r + 64; x++)
+			{
+				int state = states[(size_t)y * side + x];
+				int count = sums[(size_t)(y + r + 1) * (side + 1) + x + r + 1] - sums[(size_t)(y - r) * (side + 1) + x + r + 1] -
+					sums[(size_t)(y + r + 1) * (side + 1) + x - r] + sums[(size_t)(y - r) * (side + 1) + x - r] - (state == 1);
+				int next;
+				if (state == 0)
+				{
+					next = born[count];
+				}
+				else if (state == 1)
+				{
+					next = survives[count] ? 1 : (rules.states > 2 ? 2 : 0);
+				}
+				else
+				{
+					next = (state + 1) % rules.states;
+				}
+				if (next != state)
+				{
+					cellLoc loc = { tile->x * 64 + x - r, tile->y * 64 + y - r };
+					cells[loc].nextState = next;
+					cellsToUpdate.push_back(loc);
+				}
+			}
+		}
+	}
+
+	// Tiles aren't evaluated here, but forget the ones the pattern has left (outside every counted tile) so the activity map
+	// doesn't grow along its trail
+	awakeTiles = 0;
+	for (map<cellLoc, tileActivity>::iterator tile = activity.begin(); tile != activity.end();)
+	{
+		bool quiet = tile->second.changes[1] == 0 && tile->second.changes[2] == 0 && tile->second.wake == 0;
+		bool outside = counted.count({ tile->first.x >> (6 - ACTIVITY_SHIFT), tile->first.y >> (6 - ACTIVITY_SHIFT) }) == 0;
+		tile = (quiet && outside) ? activity.erase(tile) : ++tile;
+	}
+}
+
+bool setRule(const string& text)
+{
+	// Switch to a rule given in text, naming it after the matching RULES entry if there is one
+	ruleSet parsed;
+	if (!parseRule(text, parsed))
+	{
+		cout << "Unsupported rule " << text << ", keeping " << ruleName << endl;
+		return false;
+	}
+	if (!universe->supports(parsed))
+	{
+		cout << "The " << universe->name() << " engine can't run " << text << (topology != 0 ? " in a bounded universe" : "") << ", keeping " << ruleName << endl;
+		return false;
+	}
+	rules = parsed;
+	ruleName = text;
+	compileRule();
+
+	// Sleeping tiles would repeat what they did under the old rule, and forgotten ones would never look at it, so wake every
+	// tile holding a cell
+	for (map<cellLoc, cellData>::iterator it = cells.begin(); it != cells.end(); it++)
+	{
+		activity[{ it->first.x >> ACTIVITY_SHIFT, it->first.y >> ACTIVITY_SHIFT }].wake = 3;
+	}
+	for (map<string, ruleSet>::iterator rule = RULES.begin(); rule != RULES.end(); rule++)
+	{
+		if (ruleString(rule->second) == ruleString(parsed))
+		{
+			ruleName = rule->first;
+		}
+	}
+	return true;
+}
+
+bool setTopology(int kind, const string& size)
+{
+	// Bound the universe to a box given as WxH, centred on the origin
+	size_t split = size.find('x');
+	Sint64 width = 0, height = 0;
+	if (split == string::npos || !parseInteger(size.substr(0, split), 1, MAX_DENSE, width) || !parseInteger(size.substr(split + 1), 1, MAX_DENSE, height))
+	{
+		cout << "Bounded universe size should be WxH, up to " << MAX_DENSE << "x" << MAX_DENSE << ": " << size << endl;
+		return false;
+	}
+	int w = (int)width, h = (int)height;
+
+	topology = kind;
+	boundsW = w;
+	boundsH = h;
+	boundsCorner = { -(w / 2), -(h / 2) };
+	clearUniverse();
+	denseUniverse.clear();
+	return true;
+}
+
+void showStats(double fps)
+{
+	// Roll the CPU load window over once it is at least IDLE_WAIT long
+	Uint64 now = SDL_GetPerformanceCounter();
+	Uint64 span = now - statsStart;
+	if (span * 1000 >= IDLE_WAIT * perfFrequency)
+	{
+		cpuLoad = 1.0 - (double)idleTicks / span;
+		idleTicks = 0;
+		statsStart = now;
+	}
+
+	string title = ruleName + "    Current Frame: " + to_string(frame) + "     FPS: " + to_string(fps) + (inverted ? "     Dead Cells: " : "     Live Cells: ") + to_string(universe->population()) +
+		"     Center: (" + to_string(center.x) + ", " + to_string(center.y) + ")" + "     CPU: " + to_string((int)(cpuLoad * 100 + 0.5)) + "%" + "     Engine: " + universe->name() + (adaptive ? " (auto)" : "");
+	if (universe == &mapUniverse)
+	{
+		title += "     Eval List: " + to_string(cells.size()) + "     Updates: " + to_string(cellsToUpdate.size());
+		syncOccupancy();
+		if (!rowCounts.empty())
+		{
+			title += "     Bounds: " + to_string((Sint64)columnCounts.rbegin()->first - columnCounts.begin()->first + 1) + "x" +
+				to_string((Sint64)rowCounts.rbegin()->first - rowCounts.begin()->first + 1) + " (" + to_string(rowCounts.size()) + " rows, " +
+				to_string(columnCounts.size()) + " columns occupied)";
+		}
+	}
+	else if (topology == 0)
+	{
+		title += "     Box: " + to_string(denseUniverse.width) + "x" + to_string(denseUniverse.height);
+	}
+	if (topology == 0 && universe == &mapUniverse)
+	{
+		title += "     Awake: " + to_string(awakeTiles) + "/" + to_string(activity.size()) + " tiles";
+	}
+	else if (topology != 0)
+	{
+		const string kinds[4] = { "", "Torus", "Klein bottle", "Plane" };
+		title += "     " + kinds[topology] + " " + to_string(boundsW) + "x" + to_string(boundsH);
+	}
+	if (cycle.period > 0)
+	{
+		title += "     Cycle: period " + to_string(cycle.period) + ((cycle.dx != 0 || cycle.dy != 0) ? " moving (" + to_string(cycle.dx) + ", " + to_string(cycle.dy) + ")" : "");
+	}
+	if (HISTORY_MEMORY > 0 && !history.empty())
+	{
+		title += "     History: " + to_string(frame - history.front().frame) + " gens, " + to_string(historyBytes / 1048576) + " MB";
+		if (seekTime >= 0)
+		{
+			title += ", seek " + to_string((int)seekTime) + " ms";
+		}
+	}
+	if (CHECKPOINT_INTERVAL > 0)
+	{
+		title += "     Checkpoint: every " + to_string(CHECKPOINT_INTERVAL) + ", " + to_string((int)checkpointRate) + " MB/s, +" + to_string(checkpointCopies * sizeof(cowTile) / 1024) + " KB";
+	}
+	SDL_SetWindowTitle(window, title.c_str());
+}
+
+vector<Uint64> soupBits(int w, int h, double density)
+{
+	// A random w x h soup as a packed bitmap, 64 cells per word and each row starting a word, every cell on with probability
+	// density to 64 bits. Each word is built from the binary expansion of density, ORing or ANDing in one random word per bit
+	// from the lowest set bit up, so 0.5 takes one draw and 0.375 three, and no density takes more than 64. Bitmaps drawn a
+	// few rows at a time come out the same as one drawn whole.
+	int rowWords = (w + 63) / 64;
+	vector<Uint64> soup((size_t)rowWords * h);
+	double scaled = ldexp(density, 64);
+	Uint64 threshold = scaled <= 0 ? 0 : (scaled >= 18446744073709551616.0 ? ~0ull : (Uint64)scaled);
+	int lowest = 0;
+	while (lowest < 64 && ((threshold >> lowest) & 1) == 0)
+	{
+		lowest++;
+	}
+	for (size_t i = 0; i < soup.size(); i++)
+	{
+		Uint64 bits = density >= 1 ? ~0ull : 0;
+		for (int b = lowest; b < 64 && density < 1; b++)
+		{
+			bits = ((threshold >> b) & 1) ? (bits | rng.next()) : (bits & rng.next());
+		}
+		soup[i] = bits;
+	}
+	return soup;
+}
+
+int splitTile(cellLoc tileLoc, const cowTile& tile, checkpointTile* blocks)
+{
+	// Break a 64x64 tile into its non-empty 8x8 checkpoint blocks, returning how many were written
+	int count = 0;
+	for (int by = 0; by < 8; by++)
+	{
+		for (int bx = 0; bx < 8; bx++)
+		{
+			Uint64 bits = 0;
+			for (int y = 0; y < 8; y++)
+			{
+				bits |= ((tile.rows[by * 8 + y] >> (bx * 8)) & 0xFF) << (y * 8);
+			}
+			if (bits != 0)
+			{
+				blocks[count++] = { tileLoc.x * 8 + bx, tileLoc.y * 8 + by, bits };
+			}
+		}
+	}
+	return count;
+}
+
+void stepGeneration()
+{
+	// Advance the universe one generation
+	cellsToUpdate.clear();
+	cellsToRemove.clear();
+	Uint64 start = SDL_GetPerformanceCounter();
+
+	// Evaluate all cells for next state
+	if (topology != 0)
+	{
+		setBoundedNextState();
+	}
+	else if (rules.range > 1)
+	{
+		setRangeNextState();
+	}
+	else
+	{
+		setNextState();
+	}
+	Uint64 evaluated = SDL_GetPerformanceCounter();
+
+	// Update cells
+	inStep = true;
+	for (size_t i = 0; i < cellsToUpdate.size(); i++)
+	{
+		map<cellLoc, cellData>::iterator it = cells.find(cellsToUpdate[i]);
+		if (it != cells.end() && it->second.currState != it->second.nextState)
+		{
+			updateCell(it);
+		}
+	}
+	inStep = false;
+	Uint64 updated = SDL_GetPerformanceCounter();
+
+	//Remove inactive cells with no neighbors
+	removeCells();
+	endTileGeneration();
+	stepPhaseTicks[0] += evaluated - start;
+	stepPhaseTicks[1] += updated - evaluated;
+	stepPhaseTicks[2] += SDL_GetPerformanceCounter() - updated;
+	if (topology == 0)
+	{
+		inverted = phaseInverts[inverted];
+	}
+}
+
+bool switchEngine(engine* next)
+{
+	// Move the universe onto another engine. Only cells in state 1 carry over, and the history and cycles start again.
+	if (next == universe)
+	{
+		return true;
+	}
+	if (inverted || !next->supports(rules))
+	{
+		cout << "The " << next->name() << " engine can't run " << ruleString(rules) << (inverted ? " with the background on" : "") << ", staying on " << universe->name() << endl;
+		return false;
+	}
+	vector<pair<cellLoc, int>> found;
+	universe->viewport({ INT_MIN, INT_MIN }, { INT_MAX, INT_MAX }, found);
+	vector<cellLoc> live;
+	for (size_t i = 0; i < found.size(); i++)
+	{
+		if (found[i].second == 1)
+		{
+			live.push_back(found[i].first);
+		}
+	}
+	universe->clear();
+	next->clear();
+	next->load(live);
+	universe = next;
+	resetHistory();
+	resetCycles();
+	cout << "Switched to the " << universe->name() << " engine" << endl;
+	return true;
+}
+
+void syncOccupancy()
+{
+	// Bring rowCounts and columnCounts up to date: counted afresh from the cells if they aren't being kept, otherwise by counting
+	// the queued changes. Empty rows and columns are dropped, so the ends of the maps stay on the bounding box.
+	if (!occupancyTracked)
+	{
+		rowCounts.clear();
+		columnCounts.clear();
+		occupancyChanges.clear();
+		for (map<cellLoc, cellData>::iterator it = cells.begin(); it != cells.end(); it++)
+		{
+			if (it->second.currState != 0)
+			{
+				rowCounts[it->first.y]++;
+				columnCounts.emplace_hint(columnCounts.end(), it->first.x, 0)->second++;
+			}
+		}
+		occupancyTracked = true;
+		return;
+	}
+	auto occupy = [](map<int, int>& counts, int index, int present)
+	{
+		map<int, int>::iterator count = counts.emplace(index, 0).first;
+		count->second += present;
+		if (count->second == 0)
+		{
+			counts.erase(count);
+		}
+	};
+	for (size_t i = 0; i < occupancyChanges.size(); i++)
+	{
+		int present = occupancyChanges[i].to != 0 ? 1 : -1;
+		occupy(rowCounts, occupancyChanges[i].loc.y, present);
+		occupy(columnCounts, occupancyChanges[i].loc.x, present);
+	}
+	occupancyChanges.clear();
+}
+
+void syncShape()
+{
+	// Bring shapeHash and the centroid sums up to date: from every cell if they aren't being kept, otherwise from the queued
+	// changes. Each run of changes in one column is summed before it is multiplied by the column's power.
+	if (!shapeTracked)
+	{
+		shapeHash = 0;
+		sumX = sumY = 0;
+		shapeChanges.clear();
+		for (map<cellLoc, cellData>::iterator it = cells.begin(); it != cells.end(); it++)
+		{
+			if (it->second.currState != 0)
+			{
+				shapeChanges.push_back({ it->first, 0, it->second.currState });
+			}
+		}
+		shapeTracked = true;
+	}
+	for (size_t i = 0; i < shapeChanges.size();)
+	{
+		int x = shapeChanges[i].loc.x;
+		Uint64 column = 0;
+		for (; i < shapeChanges.size() && shapeChanges[i].loc.x == x; i++)
+		{
+			// A cell in state s contributes s times its power
+			const stateChange& change = shapeChanges[i];
+			column = (column + mulMod(axisPower(1, change.loc.y), (HASH_PRIME + change.to - change.from) % HASH_PRIME)) % HASH_PRIME;
+			int present = (change.to != 0) - (change.from != 0);
+			sumX += present * x;
+			sumY += present * change.loc.y;
+		}
+		shapeHash = (shapeHash + mulMod(column, axisPower(0, x))) % HASH_PRIME;
+	}
+	shapeChanges.clear();
+}
+
+void toggleCell(cellLoc mousePos)
+{
+	// Toggle the cell under the mouse and start a stroke that paints its new state
+	lastBrush = screenToCell(mousePos);
+	brushState = cellState(lastBrush) ? 0 : 1;
+	queueBrush(lastBrush);
+}
+
+void trackActivity(int x, int y)
+{
+	// Add a toggle to its tile's change history. Toggles on the rim also make sure the tiles next to it are tracked, since their
+	// cells' neighborhoods changed; toggles outside a generation step wake the tile and its neighbors.
+	const int size = 1 << ACTIVITY_SHIFT;
+	int tx = x >> ACTIVITY_SHIFT, ty = y >> ACTIVITY_SHIFT;
+	int lx = x & (size - 1), ly = y & (size - 1);
+	Uint64 key = cellKey(x, y);
+
+	tileActivity& tile = activity[{tx, ty}];
+	tile.changes[0] ^= key;
+	tile.toggled[0].push_back({ x, y });
+	bool onRim[8] = { lx == 0, lx == size - 1, ly == 0, ly == size - 1, lx == 0 && ly == 0, lx == size - 1 && ly == 0, lx == 0 && ly == size - 1, lx == size - 1 && ly == size - 1 };
+	for (int r = 0; r < 8; r++)
+	{
+		if (onRim[r])
+		{
+			tile.rim[0][r] ^= key;
+		}
+	}
+
+	for (int ny = ty - 1; ny <= ty + 1; ny++)
+	{
+		for (int nx = tx - 1; nx <= tx + 1; nx++)
+		{
+			bool touches = (nx == tx || (nx < tx ? lx == 0 : lx == size - 1)) && (ny == ty || (ny < ty ? ly == 0 : ly == size - 1));
+			if (!inStep)
+			{
+				activity[{nx, ny}].wake = 3;
+			}
+			else if (touches && (nx != tx || ny != ty))
+			{
+				activity[{nx, ny}];
+			}
+		}
+	}
+}
+
+void trackChange(int x, int y, int from, int to)
+{
+	// Record a cell's change of state in the rewind history and the tile set, first copying its tile if a checkpoint being written may still be reading it
+	if (!replaying && HISTORY_MEMORY > 0 && rules.states == 2)
+	{
+		currentChanges.push_back({ x, y });
+	}
+
+	if (topology == 0)
+	{
+		trackActivity(x, y);
+	}
+	else
+	{
+		// Keep the bit array in step with cells
+		boundedGrid.setCell({ x, y }, to);
+	}
+
+	// The Zobrist hash changes in O(1): a cell in state s contributes 2s - 1 times its key, which leaves two state rules hashing as
+	// before. The shape hash and the row and column occupancy are only queued for, and only while something uses them; once
+	// more changes are queued than there are cells, rebuilding them when next asked is cheaper, so they stop being kept.
+	Uint64 key = cellKey(x, y);
+	if (from != 0)
+	{
+		zobristHash ^= key * (2 * from - 1);
+	}
+	if (to != 0)
+	{
+		zobristHash ^= key * (2 * to - 1);
+	}
+	if (shapeTracked)
+	{
+		shapeChanges.push_back({ { x, y }, from, to });
+		if (shapeChanges.size() > cells.size())
+		{
+			shapeTracked = false;
+			shapeChanges.clear();
+		}
+	}
+	if (occupancyTracked && (to != 0) != (from != 0))
+	{
+		occupancyChanges.push_back({ { x, y }, from, to });
+		if (occupancyChanges.size() > cells.size())
+		{
+			occupancyTracked = false;
+			occupancyChanges.clear();
+		}
+	}
+
+	bool state = to != 0;
+	map<cellLoc, shared_ptr<cowTile>>::iterator it = tiles.find({ x >> 6, y >> 6 });
+	if (it == tiles.end())
+	{
+		if (state == 0)
+		{
+			return;
+		}
+		it = tiles.insert({ { x >> 6, y >> 6 }, make_shared<cowTile>() }).first;
+		it->second->epoch = snapshotEpoch;
+	}
+	else if (it->second->epoch != snapshotEpoch)
+	{
+		if (checkpointBusy)
+		{
+			it->second = make_shared<cowTile>(*it->second);
+			checkpointCopies++;
+		}
+		it->second->epoch = snapshotEpoch;
+	}
+
+	Uint64& row = it->second->rows[y & 63];
+	if (state)
+	{
+		row |= 1ull << (x & 63);
+	}
+	else
+	{
+		row &= ~(1ull << (x & 63));
+		if (row == 0 && all_of(it->second->rows, it->second->rows + 64, [](Uint64 r) { return r == 0; }))
+		{
+			tiles.erase(it);
+		}
+	}
+}
+
+void updateCell(map<cellLoc, cellData>::iterator cell)
+{
+	int x0 = cell->first.x, y0 = cell->first.y;
+	int oldState = cell->second.currState, newState = cell->second.nextState;
+	cell->second.currState = newState;
+	trackChange(x0, y0, oldState, newState);
+	liveCells += (newState != 0) - (oldState != 0);
+	// Update each of current cell's neighbors' num_neighbors when the cell starts or stops counting as a neighbor (state 1). The
+	// map holds a column's cells in order, so each column of three takes one search, and missing neighbors are created in place.
+	int countChange = (newState == 1) - (oldState == 1);
+	if (countChange != 0)
+	{
+		for (int x = x0 - 1; x < x0 + 2; x++)
+		{
+			map<cellLoc, cellData>::iterator it = cells.lower_bound({ x, y0 - 1 });
+			for (int y = y0 - 1; y < y0 + 2; y++, it++)
+			{
+				if (x == x0 && y == y0)
+				{
+					// Don't count self
+					continue;
+				}
+				if (it == cells.end() || it->first.x != x || it->first.y != y)
+				{
+					it = cells.emplace_hint(it, cellLoc{ x, y }, cellData{ 0, 0, 0 });
+				}
+				it->second.neighbors += countChange * neighborBit(x0 - x, y0 - y);
+				if (it->second.currState == 0 && it->second.neighbors == 0)
+				{
+					// Neighbor is inactive and has no active neighbors, so remove
+					cellsToRemove.push_back(it->first);
+				}
+			}
+		}
+	}
+	if (newState == 0 && cell->second.neighbors == 0)
+	{
+		// A cell that died, or left the last dying state of a Generations rule, with no neighbors left
+		cellsToRemove.push_back(cell->first);
+	}
+	drawCell(x0, y0, newState);
+}
+
+bool verifyCheckpoint(const string& rule)
+{
+	// Step a soup under rule on the map engine, write a checkpoint and restore it under another rule, which must bring back
+	// the same rule and cells
+	if (!setRule(rule) || !switchEngine(&mapUniverse))
+	{
+		return false;
+	}
+	inverted = false;
+	universe->clear();
+	rng.seed(RANDOM_SEED);
+	vector<cellLoc> soup = randomSoup(VERIFY_SOUP, 0.5);
+	universe->load(soup);
+	universe->step(10);
+	string saved = ruleString(rules);
+	Uint64 hash = universe->hash();
+	saveCheckpoint(VERIFY_CHECKPOINT);
+	if (checkpointThread.joinable())
+	{
+		checkpointThread.join();
+	}
+	setRule("B3/S23");
+	bool restored = loadPattern(VERIFY_CHECKPOINT) && ruleString(rules) == saved && universe->hash() == hash;
+	remove(VERIFY_CHECKPOINT.c_str());
+	if (!restored)
+	{
+		cout << "Checkpoint under " << saved << " restores as " << ruleString(rules) << (universe->hash() == hash ? "" : " with different cells") << endl;
+	}
+	return restored;
+}
+
+bool verifyRun(const string& label, vector<cellLoc> start, int generations)
+{
+	// Load start into the reference engine and every engine that can run the rule and step them together, comparing each with
+	// the reference by population and hash every generation. The first divergence is reported with a few of the cells that
+	// differ. A run that grows past VERIFY_POPULATION stops there, as the engines have agreed on every generation up to it.
+	vector<engine*> engines(1, &referenceUniverse);
+	inverted = false;
+	for (int e = 0; e < (int)(sizeof(ENGINES) / sizeof(ENGINES[0])); e++)
+	{
+		if (ENGINES[e]->supports(rules))
+		{
+			engines.push_back(ENGINES[e]);
+		}
+	}
+	for (size_t e = 0; e < engines.size(); e++)
+	{
+		engines[e]->clear();
+		vector<cellLoc> live = start;
+		engines[e]->load(live);
+	}
+
+	for (int gen = 0; gen <= generations && engines[0]->population() <= VERIFY_POPULATION; gen++)
+	{
+		if (gen > 0)
+		{
+			for (size_t e = 0; e < engines.size(); e++)
+			{
+				engines[e]->step(1);
+			}
+		}
+		for (size_t e = 1; e < engines.size(); e++)
+		{
+			if (engines[e]->population() == engines[0]->population() && engines[e]->hash() == engines[0]->hash())
+			{
+				continue;
+			}
+
+			// Cells whose states differ, in map order
+			vector<pair<cellLoc, int>> expected, actual;
+			engines[0]->viewport({ INT_MIN, INT_MIN }, { INT_MAX, INT_MAX }, expected);
+			engines[e]->viewport({ INT_MIN, INT_MIN }, { INT_MAX, INT_MAX }, actual);
+			map<cellLoc, pair<int, int>> differ;
+			for (size_t i = 0; i < expected.size(); i++)
+			{
+				differ[expected[i].first].first = expected[i].second;
+			}
+			for (size_t i = 0; i < actual.size(); i++)
+			{
+				differ[actual[i].first].second = actual[i].second;
+			}
+			cout << label << ": " << engines[e]->name() << " engine diverges from " << engines[0]->name() << " at generation " << gen <<
+				" (population " << engines[e]->population() << " vs " << engines[0]->population() << ")" << endl;
+			int shown = 0;
+			for (map<cellLoc, pair<int, int>>::iterator cell = differ.begin(); cell != differ.end() && shown < 8; cell++)
+			{
+				if (cell->second.first != cell->second.second)
+				{
+					cout << "    (" << cell->first.x << ", " << cell->first.y << "): " << cell->second.first << " vs " << cell->second.second << endl;
+					shown++;
+				}
+			}
+			return false;
+		}
+	}
+	return true;
+}
+
+void writeCheckpoint(const string& path, map<cellLoc, shared_ptr<cowTile>> snapshot, checkpointHeader header, string rule)
+{
+	// Split each 64x64 tile into the file's 8x8 tiles and stream them out to a temporary file, then rename it over the old
+	// checkpoint, which replaces it atomically so a crash at any point leaves one whole checkpoint on disk
+	Uint64 start = SDL_GetPerformanceCounter();
+	string temp = path + ".tmp";
+	ofstream out(temp, ios::binary);
+	out.write((const char*)&header, sizeof(header));
+	for (map<cellLoc, shared_ptr<cowTile>>::iterator it = snapshot.begin(); it != snapshot.end(); it++)
+	{
+		checkpointTile block[64];
+		int count = splitTile(it->first, *it->second, block);
+		out.write((const char*)block, count * sizeof(checkpointTile));
+		header.tileCount += count;
+	}
+	if (header.flags & CHECKPOINT_RULE_TEXT)
+	{
+		out << rule;
+	}
+	out.seekp(0);
+	out.write((const char*)&header, sizeof(header));
+	out.close();
+#ifdef _WIN32
+	bool replaced = MoveFileExA(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	bool replaced = rename(temp.c_str(), path.c_str()) == 0;
+#endif
+
+	// Drop the snapshot's references before telling trackChange() that tiles no longer need copying
+	snapshot.clear();
+	double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+	checkpointRate = (sizeof(header) + header.tileCount * sizeof(checkpointTile)) / 1048576.0 / (seconds > 0 ? seconds : 1e-9);
+	checkpointBusy = false;
+	if (!replaced)
+	{
+		cout << "Could not replace " << path << "; the new checkpoint was left in " << temp << endl;
+		return;
+	}
+	cout << "Saved " << path << ": " << header.tileCount << " tiles at " << (int)checkpointRate << " MB/s" << endl;
+}
+
+void writeMacrocell(const string& path, vector<cellLoc> live, string rule, int gen)
+{
+	// Macrocell: quadtree nodes are written as they are built, children first, so only the sharing tables are held in memory
+	Uint64 start = SDL_GetPerformanceCounter();
+	mcWriter writer;
+	writer.out.open(path);
+	writer.out << "[M2] (GameOfLife)\n#R " << rule << "\n#G " << gen << "\n";
+
+	// The root is the smallest square centered on the origin that holds every cell (at least one 8x8 leaf)
+	int level = 3;
+	for (size_t i = 0; i < live.size(); i++)
+	{
+		while (level < 31 && (live[i].x < -(1 << (level - 1)) || live[i].x >= (1 << (level - 1)) || live[i].y < -(1 << (level - 1)) || live[i].y >= (1 << (level - 1))))
+		{
+			level++;
+		}
+	}
+	int half = 1 << (level - 1);
+	if (writer.build(level, -half, -half, live.begin(), live.end()) == 0)
+	{
+		// An empty universe still needs a root
+		writer.out << "$\n";
+	}
+	cout << "Wrote " << path << ": " << writer.count << " nodes in " << (SDL_GetPerformanceCounter() - start) * 1000 / SDL_GetPerformanceFrequency() << " ms" << endl;
+}
+
+bool writePoster(const string& path, int scale)
+{
+	// Render the whole universe to a .ppm (binary PPM) or else BMP image, however much larger than the screen. It is drawn in
+	// bands of rows, STEP_THREADS bands at a time on their own threads, and each batch is streamed out in order before the next
+	// is drawn, so only that many bands are ever held in memory.
+	Uint64 start = SDL_GetPerformanceCounter();
+	cellLoc low, high;
+	if (topology != 0)
+	{
+		low = boundsCorner;
+		high = { boundsCorner.x + boundsW, boundsCorner.y + boundsH };
+	}
+	else
+	{
+		if (!universe->bounds(low, high))
+		{
+			low = high = { 0, 0 };
+		}
+		low = { low.x - POSTER_BORDER, low.y - POSTER_BORDER };
+		high = { high.x + POSTER_BORDER + 1, high.y + POSTER_BORDER + 1 };
+	}
+	Sint64 width = ((Sint64)high.x - low.x) * scale, height = ((Sint64)high.y - low.y) * scale;
+	Sint64 rowBytes = width * 3, pitch = (rowBytes + 3) & ~3;
+	bool ppm = path.size() > 4 && path.compare(path.size() - 4, 4, ".ppm") == 0;
+	if (!ppm && pitch * height + 54 > UINT_MAX)
+	{
+		cout << "A " << width << "x" << height << " poster is too large for a BMP; write a .ppm instead" << endl;
+		return false;
+	}
+	ofstream out(path, ios::binary);
+	if (!out)
+	{
+		cout << "Couldn't write " << path << endl;
+		return false;
+	}
+
+	if (ppm)
+	{
+		out << "P6\n" << width << " " << height << "\n255\n";
+	}
+	else
+	{
+		// BITMAPFILEHEADER and BITMAPINFOHEADER, little endian, with a negative height as the rows run top down
+		auto put = [&](Uint32 value, int bytes)
+		{
+			for (int i = 0; i < bytes; i++)
+			{
+				out.put((char)(value >> (i * 8)));
+			}
+		};
+		out << "BM";
+		put((Uint32)(pitch * height + 54), 4);
+		put(0, 4);
+		put(54, 4);
+		put(40, 4);
+		put((Uint32)width, 4);
+		put((Uint32)-height, 4);
+		put(1, 2);
+		put(24, 2);
+		put(0, 4);
+		put((Uint32)(pitch * height), 4);
+		put(2835, 4);
+		put(2835, 4);
+		put(0, 4);
+		put(0, 4);
+	}
+
+	int bandCells = max(POSTER_BAND / scale, 1);
+	int bands = (int)((high.y - (Sint64)low.y + bandCells - 1) / bandCells);
+	vector<vector<Uint8>> pixels(max(STEP_THREADS, 1));
+	for (int first = 0; first < bands; first += (int)pixels.size())
+	{
+		int count = min((int)pixels.size(), bands - first);
+		vector<thread> workers;
+		for (int b = 0; b < count; b++)
+		{
+			int top = low.y + (first + b) * bandCells;
+			workers.push_back(thread(drawPosterBand, cellLoc{ low.x, top }, cellLoc{ high.x, min(top + bandCells, high.y) }, scale, !ppm, ref(pixels[b])));
+		}
+		for (int b = 0; b < count; b++)
+		{
+			workers[b].join();
+			if (ppm)
+			{
+				// PPM rows aren't padded
+				for (size_t row = 0; row * pitch < pixels[b].size(); row++)
+				{
+					out.write((const char*)&pixels[b][row * pitch], rowBytes);
+				}
+			}
+			else
+			{
+				out.write((const char*)&pixels[b][0], pixels[b].size());
+			}
+		}
+	}
+	out.close();
+	cout << "Wrote " << path << ": " << width << "x" << height << " pixels in " << (SDL_GetPerformanceCounter() - start) * 1000 / SDL_GetPerformanceFrequency() << " ms" << endl;
+	return !out.fail();
+}
+
+void writeRLE(const string& path, vector<cellLoc> live, string rule, int gen)
+{
+	// RLE: scan rows in order, writing runs as they end and wrapping lines at 70 characters
+	Uint64 start = SDL_GetPerformanceCounter();
+	sort(live.begin(), live.end(), [](const cellLoc& a, const cellLoc& b) { return a.y < b.y || (a.y == b.y && a.x < b.x); });
+	int minX = 0, maxX = -1, minY = 0, maxY = -1;
+	if (!live.empty())
+	{
+		minX = maxX = live[0].x;
+		minY = live.front().y;
+		maxY = live.back().y;
+		for (size_t i = 0; i < live.size(); i++)
+		{
+			minX = min(minX, live[i].x);
+			maxX = max(maxX, live[i].x);
+		}
+	}
+
+	ofstream out(path);
+	out << "#CXRLE Pos=" << minX << "," << minY << " Gen=" << gen << "\n";
+	out << "x = " << (maxX - minX + 1) << ", y = " << (maxY - minY + 1) << ", rule = " << rule << "\n";
+
+	size_t lineLength = 0;
+	auto emit = [&](int run, char tag)
+	{
+		string item = (run > 1 ? to_string(run) : "") + tag;
+		if (lineLength + item.size() > 70)
+		{
+			out << '\n';
+			lineLength = 0;
+		}
+		out << item;
+		lineLength += item.size();
+	};
+
+	int x = minX, y = minY;
+	for (size_t i = 0; i < live.size();)
+	{
+		// Move down to this cell's row, then across to it
+		if (live[i].y > y)
+		{
+			emit(live[i].y - y, '$');
+			y = live[i].y;
+			x = minX;
+		}
+		if (live[i].x > x)
+		{
+			emit(live[i].x - x, 'b');
+		}
+
+		// Run of adjacent live cells
+		size_t first = i;
+		for (i++; i < live.size() && live[i].y == y && live[i].x == live[i - 1].x + 1; i++);
+		emit((int)(i - first), 'o');
+		x = live[i - 1].x + 1;
+	}
+	out << "!\n";
+	cout << "Wrote " << path << ": " << live.size() << " cells in " << (SDL_GetPerformanceCounter() - start) * 1000 / SDL_GetPerformanceFrequency() << " ms" << endl;
+}
+
+void writeVideo(string path)
+{
+	// Write queued frames until the export ends: appended to a Y4M video (4:2:0, full range BT.601) if one is open, else as
+	// numbered BMP images named after path. The screen is 32 bits per pixel with 8 bits per channel.
+	string stem = path;
+	if (stem.size() > 4 && stem.compare(stem.size() - 4, 4, ".bmp") == 0)
+	{
+		stem.resize(stem.size() - 4);
+	}
+	vector<Uint8> planes;
+	while (true)
+	{
+		SDL_Surface* image;
+		{
+			unique_lock<mutex> lock(videoLock);
+			videoReady.wait(lock, [] { return !videoFrames.empty() || videoDone; });
+			if (videoFrames.empty())
 			{
-				if (x != x0 || y != y0)
-				{
-					cells[{x, y}].numNeighbors--;
-				}
-				if (cells[{x, y}].currState == 0 && cells[{x, y}].numNeighbors == 0)
+				return;
+			}
+			image = videoFrames.front();
+			videoFrames.pop_front();
+		}
+		videoReady.notify_all();
+
+		if (videoOut.is_open())
+		{
+			// One luma sample per pixel, then each chroma plane at one sample per 2x2 block
+			int w = image->w, h = image->h, cw = (w + 1) / 2, ch = (h + 1) / 2;
+			if (videoWritten == 0)
+			{
+				videoOut << "YUV4MPEG2 W" << w << " H" << h << " F" << VIDEO_FPS << ":1 Ip A1:1 C420jpeg\n";
+			}
+			const SDL_PixelFormat* f = image->format;
+			planes.resize((size_t)w * h + 2 * (size_t)cw * ch);
+			Uint8* luma = &planes[0];
+			Uint8* blue = luma + (size_t)w * h;
+			Uint8* red = blue + (size_t)cw * ch;
+			for (int by = 0; by < ch; by++)
+			{
+				for (int bx = 0; bx < cw; bx++)
 				{
-					// Neighbor is inactive and has no active neighbors, so remove
-					cellsToRemove.insert({ x, y });
+					int sumR = 0, sumG = 0, sumB = 0;
+					for (int i = 0; i < 4; i++)
+					{
+						int x = min(bx * 2 + (i & 1), w - 1), y = min(by * 2 + (i >> 1), h - 1);
+						Uint32 pixel = *(Uint32*)((Uint8*)image->pixels + y * image->pitch + x * 4);
+						int r = (pixel >> f->Rshift) & 0xFF, g = (pixel >> f->Gshift) & 0xFF, b = (pixel >> f->Bshift) & 0xFF;
+						luma[y * w + x] = (Uint8)((77 * r + 150 * g + 29 * b + 128) >> 8);
+						sumR += r;
+						sumG += g;
+						sumB += b;
+					}
+					blue[by * cw + bx] = (Uint8)(128 + ((-43 * sumR - 85 * sumG + 128 * sumB) >> 10));
+					red[by * cw + bx] = (Uint8)(128 + ((128 * sumR - 107 * sumG - 21 * sumB) >> 10));
 				}
 			}
+			videoOut << "FRAME\n";
+			videoOut.write((const char*)&planes[0], planes.size());
+		}
+		else
+		{
+			string number = to_string(videoWritten);
+			number.insert(0, number.size() < 6 ? 6 - number.size() : 0, '0');
+			if (SDL_SaveBMP(image, (stem + number + ".bmp").c_str()) != 0 && videoWritten == 0)
+			{
+				cout << "Couldn't write " << stem << number << ".bmp: " << SDL_GetError() << endl;
+			}
 		}
-		liveCells--;
+
+		lock_guard<mutex> lock(videoLock);
+		videoSpare.push_back(image);
+		videoWritten++;
 	}
-	drawCell(x0, y0, cells[cell].currState);
 }
 
-int main()
+int main(int argc, char* argv[])
 {
-	// Initialize window
-	SDL_Init(SDL_INIT_VIDEO);
-	window = SDL_CreateWindow("Conway's Game of Life", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, WIDTH, HEIGHT, SDL_WINDOW_SHOWN);
-	surface = SDL_GetWindowSurface(window);
+	// Command line options
+	string patternFile;
+	engine* selected = universe;
+	int verifyGenerations = 0;
+	string benchFile, baselineFile, scaleFile, posterFile;
+	Sint64 scaleCells = SCALE_MAX_CELLS, latencyCells = 0;
+	string recordFile, replayFile;
+	bool headless = false;
+	Sint64 number = 0;
+
+	// A recording keeps the other options, and a replay runs with the ones its session was recorded with. Exporting video
+	// doesn't change the run, so a replay can be exported.
+	vector<string> args;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--record" && i + 1 < argc)
+		{
+			recordFile = argv[++i];
+		}
+		else if (arg == "--replay" && i + 1 < argc)
+		{
+			replayFile = argv[++i];
+		}
+		else if (arg == "--headless")
+		{
+			headless = true;
+		}
+		else if (arg == "--video" && i + 1 < argc)
+		{
+			// Export the run (or the replay) as it goes, optionally followed by the generations between frames
+			videoPath = argv[++i];
+			if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0]))
+			{
+				if (!optionNumber(arg, argv[++i], 1, INT_MAX, number))
+				{
+					return 1;
+				}
+				VIDEO_EVERY = (int)number;
+			}
+		}
+		else if (arg == "--video-queue" && i + 1 < argc)
+		{
+			if (!optionNumber(arg, argv[++i], 1, INT_MAX, number))
+			{
+				return 1;
+			}
+			VIDEO_QUEUE = (int)number;
+		}
+		else
+		{
+			args.push_back(arg);
+		}
+	}
+	if (!replayFile.empty())
+	{
+		args.clear();
+		recordFile.clear();
+		if (!readSession(replayFile, args))
+		{
+			return 1;
+		}
+	}
+
+	for (int i = 0; i < (int)args.size(); i++)
+	{
+		string arg = args[i];
+		if (arg == "--seed" && i + 1 < (int)args.size())
+		{
+			if (!optionNumber(arg, args[++i], 0, LLONG_MAX, number))
+			{
+				return 1;
+			}
+			RANDOM_SEED = (Uint64)number;
+		}
+		else if (arg == "--checkpoint" && i + 1 < (int)args.size())
+		{
+			if (!optionNumber(arg, args[++i], 0, INT_MAX, number))
+			{
+				return 1;
+			}
+			CHECKPOINT_INTERVAL = (int)number;
+		}
+		else if (arg == "--history" && i + 1 < (int)args.size())
+		{
+			if (!optionNumber(arg, args[++i], 0, INT_MAX, number))
+			{
+				return 1;
+			}
+			HISTORY_MEMORY = (size_t)number;
+		}
+		else if (arg == "--density" && i + 1 < (int)args.size())
+		{
+			// A fraction, so not optionNumber()
+			istringstream text(args[++i]);
+			if (!(text >> SOUP_DENSITY) || !text.eof() || SOUP_DENSITY < 0 || SOUP_DENSITY > 1)
+			{
+				cout << "Usage: --density takes a fraction from 0 to 1, not \"" << args[i] << "\"" << endl;
+				return 1;
+			}
+		}
+		else if ((arg == "--torus" || arg == "--klein" || arg == "--plane") && i + 1 < (int)args.size())
+		{
+			// Bounded universe of the given WxH size
+			if (!setTopology(arg == "--torus" ? TOPOLOGY_TORUS : (arg == "--klein" ? TOPOLOGY_KLEIN : TOPOLOGY_PLANE), args[++i]))
+			{
+				return 1;
+			}
+		}
+		else if (arg == "--verify")
+		{
+			// Headless differential test of the engines, optionally followed by the generations per run
+			verifyGenerations = VERIFY_GENERATIONS;
+			if (i + 1 < (int)args.size() && isdigit((unsigned char)args[i + 1][0]))
+			{
+				if (!optionNumber(arg, args[++i], 1, INT_MAX, number))
+				{
+					return 1;
+				}
+				verifyGenerations = (int)number;
+			}
+		}
+		else if (arg == "--bench" && i + 1 < (int)args.size())
+		{
+			// Headless benchmark of the corpus, written to the named JSON file
+			benchFile = args[++i];
+		}
+		else if (arg == "--compare" && i + 1 < (int)args.size())
+		{
+			// Check the benchmark against a JSON file written by an earlier --bench
+			baselineFile = args[++i];
+		}
+		else if (arg == "--scale" && i + 1 < (int)args.size())
+		{
+			// Headless scaling sweep written to the named CSV file, optionally followed by the largest soup
+			scaleFile = args[++i];
+			if (i + 1 < (int)args.size() && isdigit((unsigned char)args[i + 1][0]))
+			{
+				if (!optionNumber(arg, args[++i], 1, LLONG_MAX, scaleCells))
+				{
+					return 1;
+				}
+			}
+		}
+		else if (arg == "--latency")
+		{
+			// Headless latency benchmark of the interactive operations, optionally followed by the largest soup
+			latencyCells = LATENCY_MAX_CELLS;
+			if (i + 1 < (int)args.size() && isdigit((unsigned char)args[i + 1][0]))
+			{
+				if (!optionNumber(arg, args[++i], 1, LLONG_MAX, latencyCells))
+				{
+					return 1;
+				}
+			}
+		}
+		else if (arg == "--poster" && i + 1 < (int)args.size())
+		{
+			// Headless render of the pattern to the named image, optionally followed by the pixels per cell side
+			posterFile = args[++i];
+			if (i + 1 < (int)args.size() && isdigit((unsigned char)args[i + 1][0]))
+			{
+				if (!optionNumber(arg, args[++i], 1, INT_MAX, number))
+				{
+					return 1;
+				}
+				POSTER_SCALE = (int)number;
+			}
+		}
+		else if (arg == "--threads" && i + 1 < (int)args.size())
+		{
+			if (!optionNumber(arg, args[++i], 0, INT_MAX, number))
+			{
+				return 1;
+			}
+			STEP_THREADS = (int)number;
+		}
+		else if (arg == "--trials" && i + 1 < (int)args.size())
+		{
+			if (!optionNumber(arg, args[++i], 1, INT_MAX, number))
+			{
+				return 1;
+			}
+			BENCH_TRIALS = (int)number;
+		}
+		else if (arg == "--engine" && i + 1 < (int)args.size())
+		{
+			// An engine by name, or auto to let the adaptive controller choose
+			adaptive = args[++i] == "auto";
+			selected = adaptive ? &mapUniverse : findEngine(args[i]);
+			if (selected == NULL)
+			{
+				cout << "Unknown engine " << args[i] << "; engines are auto";
+				for (int e = 0; e < (int)(sizeof(ENGINES) / sizeof(ENGINES[0])); e++)
+				{
+					cout << " " << ENGINES[e]->name();
+				}
+				cout << endl;
+				return 1;
+			}
+		}
+		else
+		{
+			patternFile = arg;
+		}
+	}
+
+	if (STEP_THREADS <= 0)
+	{
+		STEP_THREADS = SDL_GetCPUCount();
+	}
+	boundedGrid.setThreads(STEP_THREADS);
+	for (int e = 0; e < (int)(sizeof(ENGINES) / sizeof(ENGINES[0])); e++)
+	{
+		ENGINES[e]->setThreads(STEP_THREADS);
+	}
+
+	if (!baselineFile.empty() && benchFile.empty())
+	{
+		benchFile = "bench.json";
+	}
+	if (verifyGenerations > 0 || !benchFile.empty() || !scaleFile.empty() || latencyCells > 0 || !posterFile.empty())
+	{
+		// No window: cells are drawn to an offscreen surface, runs are seeded so they repeat, and nothing is kept to rewind
+		surface = SDL_CreateRGBSurface(0, WIDTH, HEIGHT, 32, 0, 0, 0, 0);
+		perfFrequency = SDL_GetPerformanceFrequency();
+		if (RANDOM_SEED == 0)
+		{
+			RANDOM_SEED = 1;
+		}
+		HISTORY_MEMORY = 0;
+		compileRule();
+		denseUniverse.clear();
+		int failures;
+		if (verifyGenerations > 0)
+		{
+			failures = runVerify(verifyGenerations);
+		}
+		else if (!benchFile.empty())
+		{
+			failures = runBenchmark(benchFile, baselineFile, patternFile);
+		}
+		else if (!scaleFile.empty())
+		{
+			failures = runScaling(scaleFile, scaleCells);
+		}
+		else if (!posterFile.empty())
+		{
+			failures = (switchEngine(selected) && (patternFile.empty() || loadPattern(patternFile)) && writePoster(posterFile, POSTER_SCALE)) ? 0 : 1;
+		}
+		else
+		{
+			failures = switchEngine(selected) ? runLatency(latencyCells) : 1;
+		}
+		SDL_FreeSurface(surface);
+		return failures > 0 ? 1 : 0;
+	}
+
+	// Initialize window, or for a headless replay an offscreen surface
+	if (headless && !replayFile.empty())
+	{
+		surface = SDL_CreateRGBSurface(0, WIDTH, HEIGHT, 32, 0, 0, 0, 0);
+	}
+	else
+	{
+		SDL_Init(SDL_INIT_VIDEO);
+		window = SDL_CreateWindow("Conway's Game of Life", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, WIDTH, HEIGHT, SDL_WINDOW_SHOWN);
+		surface = SDL_GetWindowSurface(window);
+	}
+
+	if (RANDOM_SEED == 0)
+	{
+		RANDOM_SEED = (Uint64)time(0);
+	}
+	rng.seed(RANDOM_SEED);	// Random seed
+	cout << "Random seed: " << RANDOM_SEED << endl;
+	if (!recordFile.empty())
+	{
+		// The header: the seed and the options to start the replay the same way
+		sessionOut.open(recordFile, ios::binary);
+		Uint32 count = (Uint32)args.size();
+		sessionOut.write(SESSION_MAGIC, sizeof(SESSION_MAGIC));
+		sessionOut.write((const char*)&RANDOM_SEED, 8);
+		sessionOut.write((const char*)&count, 4);
+		for (size_t i = 0; i < args.size(); i++)
+		{
+			Uint32 length = (Uint32)args[i].size();
+			sessionOut.write((const char*)&length, 4);
+			sessionOut.write(args[i].data(), length);
+		}
+	}
+	if (!replayFile.empty())
+	{
+		// The controller's switches were recorded, as they depend on timing
+		adaptive = false;
+		sessionReplay = true;
+	}
+	if (!videoPath.empty())
+	{
+		// A .y4m path is one video file; anything else names a sequence of BMP images
+		if (videoPath.size() > 4 && videoPath.compare(videoPath.size() - 4, 4, ".y4m") == 0)
+		{
+			videoOut.open(videoPath, ios::binary);
+			if (!videoOut)
+			{
+				cout << "Couldn't write " << videoPath << endl;
+				return 1;
+			}
+		}
+		videoThread = thread(writeVideo, videoPath);
+	}
+	compileRule();
+	denseUniverse.clear();
+	if (!switchEngine(selected))
+	{
+		return 1;
+	}
 
-	string title;
-	srand((unsigned int)time(0));	// Random seed
+	// Load a pattern (RLE or Macrocell) named on the command line
+	if (!patternFile.empty() && loadPattern(patternFile))
+	{
+		moveScreen(center);
+	}
 	bool running = true;
 	bool paused = true;
 	bool singleFrame = false;
-	clock_t t1, t2;
-	long elapsed;
+	double fps = 0;
 
-	t1 = clock();
+	perfFrequency = SDL_GetPerformanceFrequency();
+	statsStart = SDL_GetPerformanceCounter();
+	Uint64 lastGeneration = statsStart;
+	Uint64 nextGeneration = statsStart;
+	Uint64 nextStats = statsStart;
+	sessionStart = statsStart;
 
 	// Event Handler
 	SDL_Event event;
 
 	while (running)
 	{
-		// Check events
-		while (SDL_PollEvent(&event))
+		// Block until an event arrives or the next generation (or stats refresh, while paused) is due, rather than spinning on SDL_PollEvent
+		int timeout = sessionReplay ? 0 : (paused ? msUntil(nextStats) : msUntil(nextGeneration));
+		Uint64 waitStart = SDL_GetPerformanceCounter();
+		int pending = (timeout > 0) ? SDL_WaitEventTimeout(&event, timeout) : SDL_PollEvent(&event);
+		idleTicks += SDL_GetPerformanceCounter() - waitStart;
+
+		// Check events. A replay takes its input from the session instead, and only lets the window be closed.
+		bool handled = false;
+		while (pending)
 		{
-			switch (event.type)
+			if (!sessionReplay)
+			{
+				recordSession(SESSION_EVENT, &event);
+				handleEvent(event, running, paused, singleFrame, fps);
+				handled = true;
+			}
+			else if (event.type == SDL_QUIT)
 			{
-			case SDL_QUIT:
 				running = false;
-				break;
-			case SDL_KEYDOWN:
-				switch (event.key.keysym.sym)
-				{
-				case SDLK_ESCAPE:
-					running = false;
-					break;
-				case SDLK_SPACE:
-					paused = !paused;
-					break;
-					// Arrow keys move display over 10%
-				case SDLK_LEFT:
-					center = { center.x - (numCols / 10), center.y };
-					moveScreen(center);
-					break;
-				case SDLK_RIGHT:
-					center = { center.x + (numCols / 10), center.y };
-					moveScreen(center);
-					break;
-				case SDLK_UP:
-					center = { center.x, center.y - (numCols / 10) };
-					moveScreen(center);
-					break;
-				case SDLK_DOWN:
-					center = { center.x, center.y + (numCols / 10) };
-					moveScreen(center);
-					break;
-					// PgUp/PgDn change block size
-				case SDLK_PAGEUP:
-					CELL_SIZE++;
-					moveScreen(center);
-					break;
-				case SDLK_PAGEDOWN:
-					if (CELL_SIZE > 1)
-					{
-						CELL_SIZE--;
-						moveScreen(center);
-					}
-					break;
-					// +/- Change frame rate
-				case SDLK_KP_PLUS:
-					FRAME_DELAY /= 1.2;
-					break;
-				case SDLK_KP_MINUS:
-					FRAME_DELAY *= 1.2;
-					break;
-				case SDLK_r:
-					createRandom();
-					break;
-					// Advance a single frame
-				case SDLK_s:
-					paused = false;
-					singleFrame = true;
-					break;
-				}
-			case SDL_MOUSEBUTTONDOWN:
-				toggleCell({ event.button.x, event.button.y });
+			}
+			pending = SDL_PollEvent(&event);
+		}
+		if (handled)
+		{
+			recordSession(SESSION_APPLY, NULL);
+		}
+		bool replayStep = false;
+		if (sessionReplay)
+		{
+			replayStep = replaySession(running, paused, singleFrame, fps);
+			if (sessionNext == sessionRecords.size())
+			{
+				// Done: a windowed replay carries on as a live session from here
+				finishReplay();
+				running = running && !headless;
+				paused = true;
 			}
 		}
 
+		// Apply this frame's edits in one batch before the next generation
+		if (!pendingEdits.empty())
+		{
+			applyEdits();
+			SDL_UpdateWindowSurface(window);
+		}
 
-		if (!paused)
+		// A replay steps as fast as it can whenever the session's next record is at a later generation
+		Uint64 now = SDL_GetPerformanceCounter();
+		if (sessionReplay ? !replayStep : paused)
 		{
-			frame++;
+			// Keep the CPU figure current while idle
+			if (now >= nextStats)
+			{
+				showStats(fps);
+				nextStats = now + perfFrequency * IDLE_WAIT / 1000;
+			}
+		}
+		else if (sessionReplay || now >= nextGeneration)
+		{
+			// The history, cycle detection and checkpoints follow the map engine's changes
+			bool tracked = universe == &mapUniverse;
 
-			// Clear prior to each generation
-			cellsToUpdate.clear();
-			cellsToRemove.clear();
+			// The history starts with a keyframe of the state before the first generation it covers
+			if (tracked && history.empty())
+			{
+				recordHistory();
+			}
 
-			// Evaluate all cells for next state
-			setNextState();
+			frame++;
+			sessionSteps += sessionReplay;
 
-			// Update cells
-			if (cellsToUpdate.size() == 0)  // Nothing changed--stable state
+			Uint64 stepStart = SDL_GetPerformanceCounter(), stepTicks = 0;
+			if (tracked)
 			{
-				paused = true;
+				bool wasInverted = inverted;
+				stepGeneration();
+				stepTicks = SDL_GetPerformanceCounter() - stepStart;
+				if (inverted != wasInverted)
+				{
+					// The background flipped, so every cell on screen changes colour
+					moveScreen(center);
+				}
+				if (cellsToUpdate.size() == 0)  // Nothing changed--stable state
+				{
+					paused = true;
+				}
+
+				recordHistory();
+
+				// Oscillating and spaceship-only universes would otherwise run forever
+				if (detectCycle())
+				{
+					paused = true;
+					cout << "Generation " << frame << ": period " << cycle.period << " cycle";
+					if (cycle.dx != 0 || cycle.dy != 0)
+					{
+						cout << " moving (" << cycle.dx << ", " << cycle.dy << ")";
+					}
+					cout << ", press F to fast forward" << endl;
+				}
+
+				// Periodic checkpoints are written in the background while stepping continues
+				if (CHECKPOINT_INTERVAL > 0 && frame % CHECKPOINT_INTERVAL == 0)
+				{
+					saveCheckpoint(CHECKPOINT_FILE);
+				}
 			}
 			else
 			{
-				for (set<cellLoc>::iterator loc = cellsToUpdate.begin(); loc != cellsToUpdate.end(); loc++)
+				// Other engines don't draw cells as they change, so redraw the view, and spot a stable state by its hash
+				Uint64 before = universe->hash();
+				universe->step(1);
+				stepTicks = SDL_GetPerformanceCounter() - stepStart;
+				moveScreen(center);
+				if (universe->hash() == before)
 				{
-					if (cells.find(*loc) != cells.end())
-					{
-						updateCell(*loc);
-					}
+					paused = true;
 				}
 			}
 
-			//Remove inactive cells with no neighbors
-			removeCells();
-
-			if (liveCells == 0)
+			if (universe->population() == 0)
 			{
 				paused = true;
 			}
 
+			// Switch engine at this generation boundary if another is predicted to be faster
+			if (adaptive && adaptEngine(stepTicks))
+			{
+				moveScreen(center);
+				recordSession(SESSION_ENGINE, NULL);
+			}
+
 			if (singleFrame)
 			{
 				paused = true;
@@ -404,14 +5904,23 @@ int main()
 			}
 
 			SDL_UpdateWindowSurface(window);
-			SDL_Delay(FRAME_DELAY);
+			if (!videoPath.empty() && frame % VIDEO_EVERY == 0)
+			{
+				queueVideoFrame();
+			}
+
+			// Schedule the next generation FRAME_DELAY after this one was due; if we fell behind, restart from now rather than bursting to catch up
+			now = SDL_GetPerformanceCounter();
+			nextGeneration += perfFrequency * FRAME_DELAY / 1000;
+			if (nextGeneration < now)
+			{
+				nextGeneration = now;
+			}
 
-			t2 = clock();
-			elapsed = timediff(t1, t2);
-			title = ruleName + "    Current Frame: " + to_string(frame) + "     FPS: " + to_string(1000.0 / elapsed) + "     Live Cells: " + to_string(liveCells) + "     Eval List: " + to_string(cells.size()) +
-				"     Updates: " + to_string(cellsToUpdate.size()) + "     Center: (" + to_string(center.x) + ", " + to_string(center.y) + ")";
-			SDL_SetWindowTitle(window, title.c_str());
-			t1 = t2;
+			fps = (double)perfFrequency / (now - lastGeneration);
+			lastGeneration = now;
+			showStats(fps);
+			nextStats = now;
 
 			/*
 			if (frame % 100 == 0)
@@ -422,6 +5931,27 @@ int main()
 		}
 	}
 
+	if (sessionReplay)
+	{
+		finishReplay();
+	}
+	recordSession(SESSION_END, NULL);
+	sessionOut.close();
+	if (!videoPath.empty())
+	{
+		finishVideo();
+	}
+
+	// Let any export or checkpoint finish before exiting
+	if (exportThread.joinable())
+	{
+		exportThread.join();
+	}
+	if (checkpointThread.joinable())
+	{
+		checkpointThread.join();
+	}
+
 	// Shut down SDL
 	SDL_DestroyWindow(window);
 	SDL_Quit();